@@ -0,0 +1,132 @@
+#include "actuator.h"
+#include "common.h"
+
+#include "driver/gpio.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+static const char *TAG = "actuator";
+
+// Each actuator's options are found by its ID, the Kconfig turns ID_ACTIVE_HIGH into ID_ACTIVE_LEVEL for this
+#define ACTUATOR_CONFIG_ENTRY(id, actuator_name)                               \
+  [ACTUATOR_##id] = {.name = actuator_name,                                    \
+                     .gpio = CONFIG_##id##_GPIO_NUMBER,                        \
+                     .active_level = CONFIG_##id##_ACTIVE_LEVEL,               \
+                     .minimum_on_ms = CONFIG_##id##_MINIMUM_ON_SECONDS * 1000, \
+                     .minimum_off_ms = CONFIG_##id##_MINIMUM_OFF_SECONDS * 1000},
+
+static const struct ActuatorConfig actuator_configs[ACTUATOR_COUNT] = {ACTUATOR_LIST(ACTUATOR_CONFIG_ENTRY)};
+#undef ACTUATOR_CONFIG_ENTRY
+
+struct ActuatorState {
+  bool on;
+  int64_t changed_at;
+  // On time from completed on periods, the current one is added when asked for
+  int64_t on_time_us;
+  uint32_t switch_count;
+};
+
+// The controller and the safety supervisor both switch actuators, from different tasks
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+static struct ActuatorState actuator_states[ACTUATOR_COUNT];
+
+static void write_level(enum ActuatorId id, bool on) {
+  const struct ActuatorConfig *config = &actuator_configs[id];
+  gpio_set_level(config->gpio, on ? config->active_level : !config->active_level);
+}
+
+static void record_switch(struct ActuatorState *state, bool on, int64_t now) {
+  if (state->on && !on) {
+    state->on_time_us += now - state->changed_at;
+  }
+  state->on = on;
+  state->changed_at = now;
+  state->switch_count++;
+}
+
+void initialize_actuators(void) {
+  int64_t now = esp_timer_get_time();
+  for (int id = 0; id < ACTUATOR_COUNT; id++) {
+    const struct ActuatorConfig *config = &actuator_configs[id];
+    ESP_LOGI(TAG, "Initializing %s control on pin %d (active %s)", config->name, config->gpio,
+             config->active_level ? "high" : "low");
+    pinModeOutput(config->gpio);
+    write_level(id, false);
+    // Start with the minimum off time already served, so the controller can act on the first reading
+    actuator_states[id] = (struct ActuatorState){.on = false, .changed_at = now - config->minimum_off_ms * 1000LL};
+  }
+}
+
+/**
+ * Switches the actuator if it isn't already in that state and has been in its current state for the minimum
+ * dwell time. Returns whether it switched, so callers only log real changes.
+ */
+bool actuator_set(enum ActuatorId id, bool on) {
+  const struct ActuatorConfig *config = &actuator_configs[id];
+  struct ActuatorState *state = &actuator_states[id];
+  int64_t now = esp_timer_get_time();
+  int64_t held_for_us = 0;
+  bool switched = false;
+
+  portENTER_CRITICAL(&lock);
+  if (state->on != on) {
+    int64_t dwell_us = (state->on ? config->minimum_on_ms : config->minimum_off_ms) * 1000LL;
+    if (now - state->changed_at >= dwell_us) {
+      write_level(id, on);
+      record_switch(state, on, now);
+      switched = true;
+    } else {
+      held_for_us = dwell_us - (now - state->changed_at);
+    }
+  }
+  portEXIT_CRITICAL(&lock);
+
+  if (switched) {
+    ESP_LOGI(TAG, "Turning %s %s", config->name, on ? "on" : "off");
+  } else if (held_for_us > 0) {
+    ESP_LOGD(TAG, "Holding %s %s for another %lld ms", config->name, on ? "off" : "on", held_for_us / 1000);
+  }
+  return switched;
+}
+
+bool actuator_is_on(enum ActuatorId id) {
+  portENTER_CRITICAL(&lock);
+  bool on = actuator_states[id].on;
+  portEXIT_CRITICAL(&lock);
+  return on;
+}
+
+/**
+ * Turns the actuator off regardless of dwell time. The pin is always written, so calling this repeatedly keeps
+ * asserting it, but it only logs and counts when the actuator was actually on.
+ */
+void actuator_force_off(enum ActuatorId id) {
+  struct ActuatorState *state = &actuator_states[id];
+  bool was_on;
+
+  portENTER_CRITICAL(&lock);
+  write_level(id, false);
+  was_on = state->on;
+  if (was_on) {
+    record_switch(state, false, esp_timer_get_time());
+  }
+  portEXIT_CRITICAL(&lock);
+
+  if (was_on) {
+    ESP_LOGW(TAG, "Forcing %s off", actuator_configs[id].name);
+  }
+}
+
+void actuator_get_stats(enum ActuatorId id, struct ActuatorStats *stats) {
+  const struct ActuatorState *state = &actuator_states[id];
+  int64_t now = esp_timer_get_time();
+
+  portENTER_CRITICAL(&lock);
+  stats->on = state->on;
+  stats->on_time_us = state->on_time_us + (state->on ? now - state->changed_at : 0);
+  stats->switch_count = state->switch_count;
+  portEXIT_CRITICAL(&lock);
+}
+
+const char *actuator_name(enum ActuatorId id) { return actuator_configs[id].name; }
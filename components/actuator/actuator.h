@@ -0,0 +1,38 @@
+#ifndef actuator_h
+#define actuator_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Every relay the incubator drives, as X(ID, name). The enum and the config table in actuator.c are both built
+ * from this, so adding one is an entry here plus its ID_* options in the Kconfig. */
+#define ACTUATOR_LIST(X) \
+  X(HEATER, "heater")    \
+  X(HUMIDIFIER, "humidifier")
+
+#define ACTUATOR_ENUM_ENTRY(id, name) ACTUATOR_##id,
+enum ActuatorId { ACTUATOR_LIST(ACTUATOR_ENUM_ENTRY) ACTUATOR_COUNT };
+#undef ACTUATOR_ENUM_ENTRY
+
+struct ActuatorConfig {
+  const char* name;
+  int gpio;
+  int active_level;
+  uint32_t minimum_on_ms;
+  uint32_t minimum_off_ms;
+};
+
+struct ActuatorStats {
+  bool on;
+  int64_t on_time_us;
+  uint32_t switch_count;
+};
+
+void initialize_actuators(void);
+bool actuator_set(enum ActuatorId id, bool on);
+bool actuator_is_on(enum ActuatorId id);
+void actuator_force_off(enum ActuatorId id);
+void actuator_get_stats(enum ActuatorId id, struct ActuatorStats* stats);
+const char* actuator_name(enum ActuatorId id);
+
+#endif
@@ -4,18 +4,159 @@
 #include "driver/gpio.h"
 #include "driver/i2c.h"
 #include "esp_err.h"
+#include "esp_idf_version.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
 #include "freertos/task.h"
+#include "heap_guard.h"
+#include "sampling_tradeoff.h"
 
 #define SDA_PIN CONFIG_SDA_PIN
 #define SCL_PIN CONFIG_SCL_PIN
 #define READ_INTERVAL_SECONDS CONFIG_READ_INTERVAL_SECONDS
+#define FAST_READ_INTERVAL_MS CONFIG_FAST_READ_INTERVAL_MS
+#define OVERSAMPLING_TEMPERATURE CONFIG_BME280_OVERSAMPLING_TEMPERATURE
+#define OVERSAMPLING_PRESSURE CONFIG_BME280_OVERSAMPLING_PRESSURE
+#define OVERSAMPLING_HUMIDITY CONFIG_BME280_OVERSAMPLING_HUMIDITY
+#define IIR_FILTER_COEFFICIENT CONFIG_BME280_IIR_FILTER_COEFFICIENT
+#ifdef CONFIG_BME280_MODE_NORMAL
+#define STANDBY_TIME_MS CONFIG_BME280_STANDBY_TIME_MS
+#endif
+
+#define CONTROL_CORE CONFIG_CONTROL_CORE
+#define CONTROL_TASK_PRIORITY CONFIG_CONTROL_TASK_PRIORITY
+#define READ_TASK_STACK_SIZE 2560
+#define READ_TASK_PRIORITY CONFIG_SENSOR_TASK_PRIORITY
+#define READ_TASK_COUNT 2
+
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 4, 0)
+// Command links live on the caller's stack, two starts' worth covers a register read
+#define CMD_LINK_BUFFER_SIZE I2C_LINK_RECOMMENDED_SIZE(2)
+#define cmd_link_create(buffer) i2c_cmd_link_create_static(buffer, sizeof(buffer))
+#define cmd_link_delete(cmd) i2c_cmd_link_delete_static(cmd)
+#else
+#ifdef CONFIG_ZERO_HEAP_STEADY_STATE
+#error "CONFIG_ZERO_HEAP_STEADY_STATE needs ESP-IDF 4.4 or later for static I2C command links"
+#endif
+#define CMD_LINK_BUFFER_SIZE 1
+#define cmd_link_create(buffer) i2c_cmd_link_create()
+#define cmd_link_delete(cmd) i2c_cmd_link_delete(cmd)
+#endif
+
+#define SENSOR_EVENT_QUEUE_LENGTH 12
+#define CONTROL_TASK_STACK_SIZE 3072
+#ifdef CONFIG_ZERO_HEAP_STEADY_STATE
+#define MAX_HANDLERS 4
+#endif
 
 static const char *TAG = "BME280_HELPER";
 
 ESP_EVENT_DEFINE_BASE(SENSOR_EVENTS);
 
+// Woken early when fast reads are asked for, so a slow wait doesn't hold them up
+static TaskHandle_t read_tasks[READ_TASK_COUNT];
+
+// Reads are fast until this time, written by the controller and read by the read tasks
+static portMUX_TYPE fast_reads_lock = portMUX_INITIALIZER_UNLOCKED;
+static int64_t fast_reads_until_us;
+
+#ifdef CONFIG_ZERO_HEAP_STEADY_STATE
+/* The default event loop allocates a copy of every event posted to it, so in zero heap mode readings are
+ * copied into a static queue instead and handed to the handlers by a dispatcher task. Handlers keep the
+ * esp_event signature either way. */
+struct SensorEvent {
+  int32_t event_id;
+  struct EventData data;
+};
+
+struct SensorEventHandler {
+  int32_t event_id;
+  esp_event_handler_t handler;
+};
+
+static struct SensorEventHandler handlers[MAX_HANDLERS];
+static int handler_count;
+
+static QueueHandle_t sensor_event_queue;
+static StaticQueue_t sensor_event_queue_buffer;
+static uint8_t sensor_event_queue_storage[SENSOR_EVENT_QUEUE_LENGTH * sizeof(struct SensorEvent)];
+
+static StaticTask_t dispatch_task_buffer;
+static StackType_t dispatch_task_stack[CONTROL_TASK_STACK_SIZE];
+
+/**
+ * Must be called before start_bme280_read_tasks
+ */
+esp_err_t sensor_event_handler_register(int32_t event_id, esp_event_handler_t handler) {
+  if (handler_count == MAX_HANDLERS) {
+    ESP_LOGE(TAG, "No room for another sensor event handler, there are already %d", MAX_HANDLERS);
+    return ESP_ERR_NO_MEM;
+  }
+  handlers[handler_count++] = (struct SensorEventHandler){.event_id = event_id, .handler = handler};
+  return ESP_OK;
+}
+
+static esp_err_t post_sensor_event(int32_t event_id, struct EventData *event_data) {
+  struct SensorEvent event = {.event_id = event_id, .data = *event_data};
+  return xQueueSend(sensor_event_queue, &event, portMAX_DELAY) == pdTRUE ? ESP_OK : ESP_FAIL;
+}
+
+static void task_dispatch_sensor_events(void *arg) {
+  heap_guard_watch_current_task();
+
+  struct SensorEvent event;
+  while (true) {
+    xQueueReceive(sensor_event_queue, &event, portMAX_DELAY);
+    for (int i = 0; i < handler_count; i++) {
+      if (handlers[i].event_id == event.event_id) {
+        handlers[i].handler(NULL, SENSOR_EVENTS, event.event_id, &event.data);
+      }
+    }
+    heap_guard_end_cycle();
+  }
+}
+
+static void start_sensor_event_dispatch(void) {
+  sensor_event_queue = xQueueCreateStatic(SENSOR_EVENT_QUEUE_LENGTH, sizeof(struct SensorEvent),
+                                          sensor_event_queue_storage, &sensor_event_queue_buffer);
+  xTaskCreateStaticPinnedToCore(&task_dispatch_sensor_events, "control", CONTROL_TASK_STACK_SIZE, NULL,
+                                CONTROL_TASK_PRIORITY, dispatch_task_stack, &dispatch_task_buffer, CONTROL_CORE);
+}
+#else
+/* Readings get a loop of their own rather than the default one, which runs on the network core alongside the
+ * Wi-Fi and MQTT events. Its task is the control task. */
+static esp_event_loop_handle_t sensor_event_loop;
+
+static esp_err_t create_sensor_event_loop(void) {
+  if (sensor_event_loop != NULL) {
+    return ESP_OK;
+  }
+  esp_event_loop_args_t loop_args = {.queue_size = SENSOR_EVENT_QUEUE_LENGTH,
+                                     .task_name = "control",
+                                     .task_priority = CONTROL_TASK_PRIORITY,
+                                     .task_stack_size = CONTROL_TASK_STACK_SIZE,
+                                     .task_core_id = CONTROL_CORE};
+  return esp_event_loop_create(&loop_args, &sensor_event_loop);
+}
+
+esp_err_t sensor_event_handler_register(int32_t event_id, esp_event_handler_t handler) {
+  esp_err_t err = create_sensor_event_loop();
+  if (err != ESP_OK) {
+    return err;
+  }
+  return esp_event_handler_register_with(sensor_event_loop, SENSOR_EVENTS, event_id, handler, NULL);
+}
+
+static esp_err_t post_sensor_event(int32_t event_id, struct EventData *event_data) {
+  return esp_event_post_to(sensor_event_loop, SENSOR_EVENTS, event_id, event_data, sizeof(*event_data),
+                           portMAX_DELAY);
+}
+
+static void start_sensor_event_dispatch(void) { ESP_ERROR_CHECK(create_sensor_event_loop()); }
+#endif
+
 void i2c_master_init() {
   i2c_config_t i2c_config = {.mode = I2C_MODE_MASTER,
                              .sda_io_num = SDA_PIN,
@@ -32,7 +173,8 @@ signed char BME280_I2C_bus_write(unsigned char dev_addr, unsigned char reg_addr,
   signed int iError = BME280_INIT_VALUE;
 
   esp_err_t espRc;
-  i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+  uint8_t cmd_link_buffer[CMD_LINK_BUFFER_SIZE];
+  i2c_cmd_handle_t cmd = cmd_link_create(cmd_link_buffer);
 
   i2c_master_start(cmd);
   i2c_master_write_byte(cmd, (dev_addr << 1) | I2C_MASTER_WRITE, true);
@@ -47,7 +189,7 @@ signed char BME280_I2C_bus_write(unsigned char dev_addr, unsigned char reg_addr,
   } else {
     iError = FAIL;
   }
-  i2c_cmd_link_delete(cmd);
+  cmd_link_delete(cmd);
 
   return (s8)iError;
 }
@@ -57,7 +199,8 @@ signed char BME280_I2C_bus_read(unsigned char dev_addr, unsigned char reg_addr,
   signed int iError = BME280_INIT_VALUE;
   esp_err_t espRc;
 
-  i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+  uint8_t cmd_link_buffer[CMD_LINK_BUFFER_SIZE];
+  i2c_cmd_handle_t cmd = cmd_link_create(cmd_link_buffer);
 
   i2c_master_start(cmd);
   i2c_master_write_byte(cmd, (dev_addr << 1) | I2C_MASTER_WRITE, true);
@@ -79,24 +222,151 @@ signed char BME280_I2C_bus_read(unsigned char dev_addr, unsigned char reg_addr,
     iError = FAIL;
   }
 
-  i2c_cmd_link_delete(cmd);
+  cmd_link_delete(cmd);
 
   return (s8)iError;
 }
 
 void BME280_delay_msek(unsigned int msek) { vTaskDelay(msek / portTICK_PERIOD_MS); }
 
-void task_bme280_forced_mode(void *i2c_address) {
+// The Kconfig choices only allow the values handled here
+static unsigned char oversampling_setting(int oversampling) {
+  switch (oversampling) {
+    case 0:
+      return BME280_OVERSAMP_SKIPPED;
+    case 2:
+      return BME280_OVERSAMP_2X;
+    case 4:
+      return BME280_OVERSAMP_4X;
+    case 8:
+      return BME280_OVERSAMP_8X;
+    case 16:
+      return BME280_OVERSAMP_16X;
+    default:
+      return BME280_OVERSAMP_1X;
+  }
+}
+
+static unsigned char filter_setting(int coefficient) {
+  switch (coefficient) {
+    case 2:
+      return BME280_FILTER_COEFF_2;
+    case 4:
+      return BME280_FILTER_COEFF_4;
+    case 8:
+      return BME280_FILTER_COEFF_8;
+    case 16:
+      return BME280_FILTER_COEFF_16;
+    default:
+      return BME280_FILTER_COEFF_OFF;
+  }
+}
+
+#ifdef CONFIG_BME280_MODE_NORMAL
+static unsigned char standby_setting(int standby_ms) {
+  switch (standby_ms) {
+    case 1:
+      return BME280_STANDBY_TIME_1_MS;
+    case 10:
+      return BME280_STANDBY_TIME_10_MS;
+    case 20:
+      return BME280_STANDBY_TIME_20_MS;
+    case 63:
+      return BME280_STANDBY_TIME_63_MS;
+    case 125:
+      return BME280_STANDBY_TIME_125_MS;
+    case 250:
+      return BME280_STANDBY_TIME_250_MS;
+    case 1000:
+      return BME280_STANDBY_TIME_1000_MS;
+    default:
+      return BME280_STANDBY_TIME_500_MS;
+  }
+}
+#endif
+
+/**
+ * Logs what the configured oversampling and filtering buy in noise and cost in latency, so configurations can
+ * be compared from the log
+ */
+static void log_sampling_tradeoff(void) {
+  const struct SamplingSettings settings = {.oversampling_temperature = OVERSAMPLING_TEMPERATURE,
+                                            .oversampling_pressure = OVERSAMPLING_PRESSURE,
+                                            .oversampling_humidity = OVERSAMPLING_HUMIDITY,
+                                            .iir_filter_coefficient = IIR_FILTER_COEFFICIENT,
+#ifdef CONFIG_BME280_MODE_NORMAL
+                                            .normal_mode = true,
+                                            .standby_ms = STANDBY_TIME_MS,
+#endif
+                                            .read_interval_ms = READ_INTERVAL_SECONDS * 1000};
+  struct SamplingTradeoff tradeoff;
+  compute_sampling_tradeoff(&settings, &tradeoff);
+
+  ESP_LOGI(TAG, "Conversion takes up to %.1f ms, every %.0f ms. Temperature noise is %.2fx a single 1x sample, "
+           "a step change is 75%% through after %d conversions (%.1f s)",
+           tradeoff.measurement_ms, tradeoff.conversion_period_ms, tradeoff.temperature_noise,
+           tradeoff.conversions_to_75_percent, tradeoff.settle_ms / 1000);
+}
+
+/**
+ * Keeps the sensors reading every FAST_READ_INTERVAL_MS for at least duration_ms from now. Asking again
+ * before then extends it, otherwise they drop back to READ_INTERVAL_SECONDS.
+ */
+void request_fast_sensor_reads(uint32_t duration_ms) {
+  int64_t now_us = esp_timer_get_time();
+  int64_t until_us = now_us + duration_ms * 1000LL;
+
+  portENTER_CRITICAL(&fast_reads_lock);
+  bool was_slow = fast_reads_until_us <= now_us;
+  if (until_us > fast_reads_until_us) {
+    fast_reads_until_us = until_us;
+  }
+  portEXIT_CRITICAL(&fast_reads_lock);
+
+  if (was_slow) {
+    ESP_LOGD(TAG, "Reading every %d ms for the next %u ms", FAST_READ_INTERVAL_MS, duration_ms);
+    for (int i = 0; i < READ_TASK_COUNT; i++) {
+      if (read_tasks[i] != NULL) {
+        xTaskNotifyGive(read_tasks[i]);
+      }
+    }
+  }
+}
+
+static int64_t read_interval_us(int64_t now_us) {
+  portENTER_CRITICAL(&fast_reads_lock);
+  bool fast = now_us < fast_reads_until_us;
+  portEXIT_CRITICAL(&fast_reads_lock);
+  return fast ? FAST_READ_INTERVAL_MS * 1000LL : READ_INTERVAL_SECONDS * 1000000LL;
+}
+
+/**
+ * Sleeps until the next read is due. The interval is looked at again whenever the task is woken, so switching
+ * to fast reads takes effect straight away rather than after the rest of a slow wait.
+ */
+static void wait_for_next_read(int64_t last_read_us) {
+  while (true) {
+    int64_t now_us = esp_timer_get_time();
+    int64_t remaining_us = last_read_us + read_interval_us(now_us) - now_us;
+    if (remaining_us <= 0) {
+      return;
+    }
+    TickType_t ticks = pdMS_TO_TICKS((remaining_us + 999) / 1000);
+    ulTaskNotifyTake(pdTRUE, ticks > 0 ? ticks : 1);
+  }
+}
+
+void task_bme280_read(void *i2c_address) {
+  const uint8_t sensor_address = *(uint8_t *)i2c_address;
   struct bme280_t bme280 = {.bus_write = BME280_I2C_bus_write,
                             .bus_read = BME280_I2C_bus_read,
-                            .dev_addr = *(uint8_t *)i2c_address,
+                            .dev_addr = sensor_address,
                             .delay_msec = BME280_delay_msek};
 
   signed int result;
   signed int v_uncomp_pressure;
   signed int v_uncomp_temperature;
   signed int v_uncomp_humidity;
-  unsigned char wait_time;
 
   result = bme280_init(&bme280);
   if (result != SUCCESS) {
@@ -104,44 +374,61 @@ void task_bme280_forced_mode(void *i2c_address) {
     vTaskDelete(NULL);
   }
 
-  result += bme280_set_oversamp_pressure(BME280_OVERSAMP_1X, &bme280);
-  result += bme280_set_oversamp_temperature(BME280_OVERSAMP_1X, &bme280);
-  result += bme280_set_oversamp_humidity(BME280_OVERSAMP_1X, &bme280);
+  result += bme280_set_oversamp_pressure(oversampling_setting(OVERSAMPLING_PRESSURE), &bme280);
+  result += bme280_set_oversamp_temperature(oversampling_setting(OVERSAMPLING_TEMPERATURE), &bme280);
+  result += bme280_set_oversamp_humidity(oversampling_setting(OVERSAMPLING_HUMIDITY), &bme280);
 
-  result += bme280_set_filter(BME280_FILTER_COEFF_OFF, &bme280);
+  result += bme280_set_filter(filter_setting(IIR_FILTER_COEFFICIENT), &bme280);
+#ifdef CONFIG_BME280_MODE_NORMAL
+  result += bme280_set_standby_durn(standby_setting(STANDBY_TIME_MS), &bme280);
+  // From here on the sensor converts continuously, reads just pick up the latest result
+  result += bme280_set_power_mode(BME280_NORMAL_MODE, &bme280);
+#endif
   if (result != SUCCESS) {
     ESP_LOGE(TAG, "Error while setting configuration. Code: %d", result);
     vTaskDelete(NULL);
   }
 
-  wait_time = bme280_compute_wait_time(&wait_time, &bme280);
+  // Everything the task needs is set up, from here on it shouldn't touch the heap
+  heap_guard_watch_current_task();
 
+  int64_t last_read_us = esp_timer_get_time();
   while (true) {
-    vTaskDelay((READ_INTERVAL_SECONDS * 1000) / portTICK_PERIOD_MS);
+    wait_for_next_read(last_read_us);
+    last_read_us = esp_timer_get_time();
+#ifdef CONFIG_BME280_MODE_NORMAL
+    result = bme280_read_uncomp_pressure_temperature_humidity(&v_uncomp_pressure, &v_uncomp_temperature,
+                                                              &v_uncomp_humidity, &bme280);
+#else
     result = bme280_get_forced_uncomp_pressure_temperature_humidity(&v_uncomp_pressure, &v_uncomp_temperature,
                                                                     &v_uncomp_humidity, &bme280);
+#endif
 
     if (result == SUCCESS) {
       float temperature = bme280_compensate_temperature_double(v_uncomp_temperature, &bme280);
       float humidity = bme280_compensate_humidity_double(v_uncomp_humidity, &bme280);
+      float pressure = bme280_compensate_pressure_double(v_uncomp_pressure, &bme280) / 100;  // Pa -> hPa
 
-      ESP_LOGD(TAG, "Address %#x, %.2f degC / %.3f hPa / %.3f %%", bme280.dev_addr, temperature,
-               bme280_compensate_pressure_double(v_uncomp_pressure, &bme280) / 100,  // Pa -> hPa
-               humidity);
-      vTaskDelay(1000 / portTICK_PERIOD_MS);
+      ESP_LOGD(TAG, "Address %#x, %.2f degC / %.3f hPa / %.3f %%", bme280.dev_addr, temperature, pressure, humidity);
 
       struct EventData event_data;
-      event_data.sensor_address = *(uint8_t *)i2c_address;
+      event_data.sensor_address = sensor_address;
+      event_data.read_time_us = last_read_us;
+
+      // Pressure goes first, so it's on hand when the humidity reading is turned into absolute moisture
+      event_data.reading = pressure;
+      ESP_ERROR_CHECK(post_sensor_event(SENSOR_READING_PRESSURE, &event_data));
 
       event_data.reading = temperature;
-      ESP_ERROR_CHECK(esp_event_post(SENSOR_EVENTS, SENSOR_READING_TEMPERATURE, &event_data, sizeof(event_data), portMAX_DELAY));
+      ESP_ERROR_CHECK(post_sensor_event(SENSOR_READING_TEMPERATURE, &event_data));
 
       event_data.reading = humidity;
-      ESP_ERROR_CHECK(esp_event_post(SENSOR_EVENTS, SENSOR_READING_HUMIDITY, &event_data, sizeof(event_data), portMAX_DELAY));
+      ESP_ERROR_CHECK(post_sensor_event(SENSOR_READING_HUMIDITY, &event_data));
 
     } else {
       ESP_LOGE(TAG, "measure error. code: %d", result);
     }
+    heap_guard_end_cycle();
   }
 
   vTaskDelete(NULL);
@@ -149,11 +436,25 @@ void task_bme280_forced_mode(void *i2c_address) {
 
 void start_bme280_read_tasks(void) {
   i2c_master_init();
-  uint8_t i2c_address_1 = BME280_I2C_ADDRESS1;
-  xTaskCreate(&task_bme280_forced_mode, "bme280_forced_mode_primary", 2048, (void *)&i2c_address_1, 6, NULL);
+  log_sampling_tradeoff();
+  start_sensor_event_dispatch();
+
+  // Static, since the tasks read these after this function has returned
+  static uint8_t i2c_address_1 = BME280_I2C_ADDRESS1;
+  static uint8_t i2c_address_2 = BME280_I2C_ADDRESS2;
+
+  static StaticTask_t primary_task_buffer;
+  static StackType_t primary_task_stack[READ_TASK_STACK_SIZE];
+  static StaticTask_t secondary_task_buffer;
+  static StackType_t secondary_task_stack[READ_TASK_STACK_SIZE];
+
+  read_tasks[0] = xTaskCreateStaticPinnedToCore(&task_bme280_read, "bme280_primary", READ_TASK_STACK_SIZE,
+                                                (void *)&i2c_address_1, READ_TASK_PRIORITY, primary_task_stack,
+                                                &primary_task_buffer, CONTROL_CORE);
 
   // Offset the second task so they happen at different times
-  uint8_t i2c_address_2 = BME280_I2C_ADDRESS2;
   vTaskDelay(500 / portTICK_PERIOD_MS);
-  xTaskCreate(&task_bme280_forced_mode, "bme280_forced_mode_secondary", 2048, (void *)&i2c_address_2, 6, NULL);
+  read_tasks[1] = xTaskCreateStaticPinnedToCore(&task_bme280_read, "bme280_secondary", READ_TASK_STACK_SIZE,
+                                                (void *)&i2c_address_2, READ_TASK_PRIORITY, secondary_task_stack,
+                                                &secondary_task_buffer, CONTROL_CORE);
 }
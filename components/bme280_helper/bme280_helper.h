@@ -6,14 +6,19 @@
 ESP_EVENT_DECLARE_BASE(SENSOR_EVENTS);
 enum {
     SENSOR_READING_TEMPERATURE,
-    SENSOR_READING_HUMIDITY
+    SENSOR_READING_HUMIDITY,
+    SENSOR_READING_PRESSURE
 };
 
 struct EventData {
   float reading;
   int sensor_address;
+  // esp_timer time the reading was taken, so the controller can tell how long it took to act on
+  int64_t read_time_us;
 };
 
+esp_err_t sensor_event_handler_register(int32_t event_id, esp_event_handler_t handler);
 void start_bme280_read_tasks(void);
+void request_fast_sensor_reads(uint32_t duration_ms);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,34 @@
+#include "sampling_tradeoff.h"
+
+#include <math.h>
+
+/**
+ * Conversion time is the datasheet's maximum, 1.25 ms plus 2.3 ms per oversample and 0.575 ms for each of
+ * pressure and humidity when they're measured
+ */
+void compute_sampling_tradeoff(const struct SamplingSettings *settings, struct SamplingTradeoff *tradeoff) {
+  tradeoff->measurement_ms = 1.25f + 2.3f * settings->oversampling_temperature;
+  if (settings->oversampling_pressure > 0) {
+    tradeoff->measurement_ms += 2.3f * settings->oversampling_pressure + 0.575f;
+  }
+  if (settings->oversampling_humidity > 0) {
+    tradeoff->measurement_ms += 2.3f * settings->oversampling_humidity + 0.575f;
+  }
+
+  tradeoff->conversion_period_ms = settings->normal_mode ? tradeoff->measurement_ms + settings->standby_ms
+                                                         : (float)settings->read_interval_ms;
+
+  // A coefficient of c is y += (x - y) / c, which passes 1 / (2c - 1) of the input noise variance
+  int coefficient = settings->iir_filter_coefficient > 1 ? settings->iir_filter_coefficient : 1;
+  int oversampling = settings->oversampling_temperature > 0 ? settings->oversampling_temperature : 1;
+  tradeoff->temperature_noise = 1.0f / sqrtf((float)(2 * coefficient - 1) * oversampling);
+
+  // Each conversion leaves 1 - 1/c of the step still to go
+  float remaining = 1.0f;
+  tradeoff->conversions_to_75_percent = 0;
+  while (remaining > 0.25f) {
+    remaining *= 1.0f - 1.0f / coefficient;
+    tradeoff->conversions_to_75_percent++;
+  }
+  tradeoff->settle_ms = tradeoff->conversions_to_75_percent * tradeoff->conversion_period_ms;
+}
@@ -0,0 +1,36 @@
+#ifndef sampling_tradeoff_h
+#define sampling_tradeoff_h
+
+#include <stdbool.h>
+
+/*
+ * What a BME280 sampling configuration buys in temperature noise and costs in latency, from the datasheet's
+ * maximum measurement time and the IIR filter's response. Plain C, so tools/host_tests can tabulate it.
+ */
+
+struct SamplingSettings {
+  // 0 (skipped), 1, 2, 4, 8 or 16
+  int oversampling_temperature;
+  int oversampling_pressure;
+  int oversampling_humidity;
+  // 0 (off), 2, 4, 8 or 16
+  int iir_filter_coefficient;
+  // Normal mode converts continuously with standby_ms in between, forced mode once per read
+  bool normal_mode;
+  int standby_ms;
+  int read_interval_ms;
+};
+
+struct SamplingTradeoff {
+  float measurement_ms;
+  float conversion_period_ms;
+  // Standard deviation of a temperature reading, relative to a single unfiltered 1x sample
+  float temperature_noise;
+  int conversions_to_75_percent;
+  // How long a step change takes to be 75% through
+  float settle_ms;
+};
+
+void compute_sampling_tradeoff(const struct SamplingSettings* settings, struct SamplingTradeoff* tradeoff);
+
+#endif
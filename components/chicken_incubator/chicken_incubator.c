@@ -1,104 +1,348 @@
 #include "chicken_incubator.h"
-#include "heater.h"
-#include "humidifier.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "actuator.h"
 #include "bme280_helper.h"
 #include "uln2003_stepper_driver.h"
 #include "esp_log.h"
 #include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "mqtt_helper.h"
+#include "psychrometrics.h"
 #include "sntp_helper.h"
+#include "safety_supervisor.h"
+#include "task_monitor.h"
 
 #define ROTATIONS_PER_DAY CONFIG_ROTATIONS_PER_DAY
+#define FAST_SAMPLING_NEAR_THRESHOLD (CONFIG_FAST_SAMPLING_NEAR_THRESHOLD_DECIDEGREES / 10.0f)
+#define FAST_SAMPLING_RATE_PER_MINUTE (CONFIG_FAST_SAMPLING_RATE_DECIDEGREES_PER_MINUTE / 10.0f)
+#define FAST_SAMPLING_HOLD_MS (CONFIG_FAST_SAMPLING_HOLD_SECONDS * 1000)
+#define READING_PUBLISH_INTERVAL_US (CONFIG_READING_PUBLISH_INTERVAL_SECONDS * 1000000LL)
+#define MAX_SENSORS 2
+#define CONTROL_CORE CONFIG_CONTROL_CORE
+#define TURNER_TASK_PRIORITY CONFIG_TURNER_TASK_PRIORITY
+#define TURNER_TASK_STACK_SIZE 2048
+// Rate of change is measured over at least this long. A BME280 wanders by a few hundredths of a degree from
+// read to read, over 5 s that alone looked like 0.3*C a minute.
+#define RATE_WINDOW_US (60 * 1000000LL)
 
 static const char *TAG = "INCUBATOR";
-static char humidity_measurement[6];
-static char temperature_measurement[6];
-
-static const unsigned long long int MICROSECONDS_PER_DAY = 86400000000; // 1000 * 1000 * 60 * 60 * 24
 
-enum HeatingState {
-  HEATING,
-  COOLING
-};
-
-enum HumidifierState {
-  HUMIDIFIER_ON,
-  HUMIDIFIER_OFF
-};
+// Rotating takes seconds of stepping, so it's done on a task of its own rather than in the timer callback
+static TaskHandle_t turner_task;
+static volatile int64_t turn_requested_at;
 
-static enum HeatingState heating_state = COOLING;
-static enum HumidifierState humidifier_state = HUMIDIFIER_OFF;
+static const unsigned long long int MICROSECONDS_PER_DAY = 86400000000; // 1000 * 1000 * 60 * 60 * 24
 
-// This is the ideal temperature for the first 18 days
+// This is the ideal temperature for the first 18 days, the last 3 (hatching) want 36.9*C, there's no switching to
+// that yet
 static float TARGET_INCUBATION_TEMPERATURE = 37.5;
-// This is the ideal temperature for the last 3 days
-static float TARGET_HATCHER_TEMPERATURE = 36.9;
 // How much the temperature can vary above and below the target before the heater is turned on
 static float TEMPERATURE_VARIANCE = 0.2;
 
-// This is the ideal humidity for the first 18 days
+// This is the ideal humidity for the first 18 days, the last 3 want 70.5%
 static float TARGET_INCUBATION_HUMIDITY = 58;
-// This is the ideal humidity for the last 3 days
-static float TARGET_HATCHER_HUMIDITY = 70.5;
 // How much the humidity can vary above and below the target before the humidifier is turned on
 static float HUMIDITY_VARIANCE = 5;
 
 // This drops the top threshold, so heating turns off sooner (hopefully overshoots less)
 static float HEATING_MAX_COMPENSATION = -0.4f;
 
+// Used for derived humidity metrics until a sensor has reported its own pressure
+static const float STANDARD_PRESSURE = 1013.25f;
+
+/* The latest temperature and pressure from each sensor, so humidity readings can be turned into
+ * absolute moisture, and what's needed to pace sampling and publishing. Handlers all run on the event loop
+ * task, so there's no locking. */
+struct SensorClimate {
+  int sensor_address;
+  float temperature;
+  float pressure;
+  // The reading the rate of change is measured from, and the last rate measured (*C per minute)
+  float reference_temperature;
+  int64_t reference_time_us;
+  float temperature_rate;
+  int64_t temperature_published_us;
+  int64_t humidity_published_us;
+};
+
+static struct SensorClimate sensor_climates[MAX_SENSORS];
+
+static struct SensorClimate *climate_for(int sensor_address) {
+  for (int i = 0; i < MAX_SENSORS; i++) {
+    if (sensor_climates[i].sensor_address == sensor_address) {
+      return &sensor_climates[i];
+    }
+    if (sensor_climates[i].sensor_address == 0) {
+      sensor_climates[i] = (struct SensorClimate){
+          .sensor_address = sensor_address, .temperature = NAN, .pressure = STANDARD_PRESSURE};
+      return &sensor_climates[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Fast reads are for the controller, so readings go out at most every READING_PUBLISH_INTERVAL per sensor.
+ * One that made an actuator switch always goes out, so the switch can be traced back to it.
+ */
+static bool publish_due(int64_t *last_published_us, bool switched) {
+  int64_t now_us = esp_timer_get_time();
+  if (!switched && *last_published_us != 0 && now_us - *last_published_us < READING_PUBLISH_INTERVAL_US) {
+    return false;
+  }
+  *last_published_us = now_us;
+  return true;
+}
+
+static void update_temperature_rate(struct SensorClimate *climate, float temperature) {
+  int64_t now_us = esp_timer_get_time();
+  int64_t elapsed_us = now_us - climate->reference_time_us;
+  if (climate->reference_time_us != 0 && elapsed_us < RATE_WINDOW_US) {
+    return;
+  }
+  if (climate->reference_time_us != 0) {
+    climate->temperature_rate = (temperature - climate->reference_temperature) * 60e6f / (float)elapsed_us;
+  }
+  climate->reference_temperature = temperature;
+  climate->reference_time_us = now_us;
+}
+
+/**
+ * Samples fast while the temperature is closing in on the threshold the heater switches at next, moving
+ * quickly, or an actuator has just switched, and lets the sensors drop back to their slow rate the rest of the
+ * time. Only the threshold ahead counts, drifting away from the one just crossed needs no fast reads.
+ */
+static void adapt_sampling(struct SensorClimate *climate, float temperature, float lower_threshold,
+                           float upper_threshold, bool switched) {
+  if (climate != NULL) {
+    update_temperature_rate(climate, temperature);
+  }
+
+  float next_threshold = actuator_is_on(ACTUATOR_HEATER) ? upper_threshold : lower_threshold;
+  bool near_threshold = fabsf(temperature - next_threshold) < FAST_SAMPLING_NEAR_THRESHOLD;
+  bool moving = climate != NULL && fabsf(climate->temperature_rate) > FAST_SAMPLING_RATE_PER_MINUTE;
+  if (switched || near_threshold || moving) {
+    request_fast_sensor_reads(FAST_SAMPLING_HOLD_MS);
+  }
+}
+
+/**
+ * snprintf's "%.<decimals>f" for readings, in integer arithmetic. Newlib formats floats through _dtoa, which is
+ * slow on the device and allocates its bigints on the calling task's first use, on the event loop with every
+ * reading published.
+ */
+static void format_decimal(char *buffer, size_t size, float value, int decimals) {
+  long scale = 1;
+  for (int i = 0; i < decimals; i++) {
+    scale *= 10;
+  }
+  // Nothing a sensor reports gets near this, but nan or a runaway value still has to come out as something
+  if (!(fabsf(value) * scale < 1e15f)) {
+    snprintf(buffer, size, "%.*f", decimals, value);
+    return;
+  }
+  // Exact in a double, and nearbyint rounds ties to even as printf does
+  long long scaled = (long long)nearbyint(fabs((double)value) * scale);
+  char digits[24];
+  int position = sizeof(digits);
+  digits[--position] = '\0';
+  for (int i = 0; i < decimals; i++, scaled /= 10) {
+    digits[--position] = '0' + scaled % 10;
+  }
+  if (decimals > 0) {
+    digits[--position] = '.';
+  }
+  do {
+    digits[--position] = '0' + scaled % 10;
+    scaled /= 10;
+  } while (scaled > 0);
+  if (value < 0) {
+    digits[--position] = '-';
+  }
+  size_t length = sizeof(digits) - 1 - position;
+  if (size > 0) {
+    length = length < size ? length : size - 1;
+    memcpy(buffer, &digits[position], length);
+    buffer[length] = '\0';
+  }
+}
+
+/**
+ * Logs every switch the controller makes, so they can be compared against a replay of the readings
+ */
+static void report_switch(char strftime_buf[], enum ActuatorId id) {
+  const char *keys[] = {"actuator", "state"};
+  const char *values[] = {actuator_name(id), actuator_is_on(id) ? "on" : "off"};
+  publish_fields(strftime_buf, "incubator/actuator_switch", keys, values, 2);
+}
+
 void chicken_temperature_reading_handler(void* handler_args, esp_event_base_t base, int32_t id, void* event_data) {
   struct EventData * data = (struct EventData *) event_data;
   float temperature = data->reading;
   int i2c_address = data->sensor_address;
 
-  snprintf(temperature_measurement, 6, "%.2f", temperature);
+  char sensor_address[5];
+  snprintf(sensor_address, sizeof(sensor_address), "%X", i2c_address);
 
   char strftime_buf[64];
   get_time_string(strftime_buf);
-  publish_message(strftime_buf, "incubator/temperature", "temperature", temperature_measurement);
 
   ESP_LOGI(TAG, "Received temperature reading: %.2f*C from sensor %X", temperature, i2c_address);
-  if (heating_state == COOLING && temperature < (TARGET_INCUBATION_TEMPERATURE - TEMPERATURE_VARIANCE)) {
-    ESP_LOGI(TAG, "Temperature %.2f*C is below threshold %.2f*C, turning heater on", temperature, TARGET_INCUBATION_TEMPERATURE - TEMPERATURE_VARIANCE);
-    turn_on_heater();
-    heating_state = HEATING;
-  } else if (heating_state == HEATING && temperature > (TARGET_INCUBATION_TEMPERATURE + TEMPERATURE_VARIANCE - HEATING_MAX_COMPENSATION)) {
-    ESP_LOGI(TAG, "Temperature %.2f*C is above threshold %.2f*C, turning heater off", temperature, TARGET_INCUBATION_TEMPERATURE + TEMPERATURE_VARIANCE);
-    turn_off_heater();
-    heating_state = COOLING;
+  safety_supervisor_record_temperature(i2c_address, temperature);
+
+  struct SensorClimate *climate = climate_for(i2c_address);
+  if (climate != NULL) {
+    climate->temperature = temperature;
+  }
+
+  float lower_threshold = TARGET_INCUBATION_TEMPERATURE - TEMPERATURE_VARIANCE;
+  float upper_threshold = TARGET_INCUBATION_TEMPERATURE + TEMPERATURE_VARIANCE - HEATING_MAX_COMPENSATION;
+  bool switched = false;
+  if (safety_fault_latched()) {
+    // The supervisor has already forced the heater off, nothing here may turn it back on. Telemetry reports it,
+    // so the report doesn't depend on readings still arriving.
+    ESP_LOGD(TAG, "Safety fault latched, leaving the heater off");
+  } else if (temperature < lower_threshold) {
+    if (actuator_set(ACTUATOR_HEATER, true)) {
+      ESP_LOGI(TAG, "Temperature %.2f*C is below threshold %.2f*C, turned heater on", temperature, lower_threshold);
+      switched = true;
+    }
+  } else if (temperature > upper_threshold) {
+    if (actuator_set(ACTUATOR_HEATER, false)) {
+      ESP_LOGI(TAG, "Temperature %.2f*C is above threshold %.2f*C, turned heater off", temperature, upper_threshold);
+      switched = true;
+    }
+  }
+
+  if (climate == NULL || publish_due(&climate->temperature_published_us, switched)) {
+    // Formatted here rather than up front, at fast read rates most readings don't go out
+    char temperature_measurement[8];
+    format_decimal(temperature_measurement, sizeof(temperature_measurement), temperature, 2);
+    const char *keys[] = {"temperature", "sensor_address"};
+    const char *values[] = {temperature_measurement, sensor_address};
+    publish_fields(strftime_buf, "incubator/temperature", keys, values, 2);
+  }
+  if (switched) {
+    report_switch(strftime_buf, ACTUATOR_HEATER);
+  }
+  adapt_sampling(climate, temperature, lower_threshold, upper_threshold, switched);
+
+  ESP_LOGI(TAG, "Heating state is: %s", actuator_is_on(ACTUATOR_HEATER) ? "HEATING" : "COOLING");
+  task_monitor_record_latency(LATENCY_CONTROL, esp_timer_get_time() - data->read_time_us);
+}
+
+void chicken_pressure_reading_handler(void* handler_args, esp_event_base_t base, int32_t id, void* event_data) {
+  struct EventData * data = (struct EventData *) event_data;
+  struct SensorClimate *climate = climate_for(data->sensor_address);
+  if (climate != NULL) {
+    climate->pressure = data->reading;
   }
+}
 
-  ESP_LOGI(TAG, "Heating state is: %s", heating_state == HEATING ? "HEATING" : "COOLING");
+/**
+ * Returns whether the humidifier switched
+ */
+static bool control_humidifier(float value, float lower_threshold, float upper_threshold, const char *unit) {
+  if (value < lower_threshold) {
+    if (actuator_set(ACTUATOR_HUMIDIFIER, true)) {
+      ESP_LOGI(TAG, "Humidity %.2f%s is below threshold %.2f%s, turned humidifier on", value, unit, lower_threshold, unit);
+      return true;
+    }
+  } else if (value > upper_threshold) {
+    if (actuator_set(ACTUATOR_HUMIDIFIER, false)) {
+      ESP_LOGI(TAG, "Humidity %.2f%s is above threshold %.2f%s, turned humidifier off", value, unit, upper_threshold, unit);
+      return true;
+    }
+  }
+  return false;
 }
 
 void chicken_humidity_reading_handler(void* handler_args, esp_event_base_t base, int32_t id, void* event_data) {
   struct EventData * data = (struct EventData *) event_data;
   float humidity = data->reading;
 
-  snprintf(humidity_measurement, 6, "%.2f", humidity);
+  char humidity_measurement[8];
+  char sensor_address[5];
+  snprintf(sensor_address, sizeof(sensor_address), "%X", data->sensor_address);
 
   char strftime_buf[64];
   get_time_string(strftime_buf);
-  publish_message(strftime_buf, "incubator/humidity", "relative_humidity", humidity_measurement);
 
   ESP_LOGI(TAG, "Received humidity reading: %.2f%%", humidity);
-  if (humidity < (TARGET_INCUBATION_HUMIDITY - HUMIDITY_VARIANCE)) {
-    ESP_LOGI(TAG, "Humidity %.2f%% is below threshold %.2f%%, turning humidifier on", humidity, TARGET_INCUBATION_HUMIDITY - HUMIDITY_VARIANCE);
-    turn_on_humidifier();
-    humidifier_state = HUMIDIFIER_ON;
-  } else if (humidity > (TARGET_INCUBATION_HUMIDITY + HUMIDITY_VARIANCE)) {
-    ESP_LOGI(TAG, "Humidity %.2f%% is above threshold %.2f%%, turning humdifier off", humidity, (TARGET_INCUBATION_HUMIDITY + HUMIDITY_VARIANCE));
-    turn_off_humidifier();
-    humidifier_state = HUMIDIFIER_OFF;
+
+  struct SensorClimate *climate = climate_for(data->sensor_address);
+  bool switched;
+  if (climate == NULL || isnan(climate->temperature)) {
+    // Nothing to derive absolute moisture from yet, so fall back to relative humidity
+    switched = control_humidifier(humidity, TARGET_INCUBATION_HUMIDITY - HUMIDITY_VARIANCE, TARGET_INCUBATION_HUMIDITY + HUMIDITY_VARIANCE, "%");
+    if (climate == NULL || publish_due(&climate->humidity_published_us, switched)) {
+      format_decimal(humidity_measurement, sizeof(humidity_measurement), humidity, 2);
+      const char *keys[] = {"relative_humidity", "sensor_address"};
+      const char *values[] = {humidity_measurement, sensor_address};
+      publish_fields(strftime_buf, "incubator/humidity", keys, values, 2);
+    }
+  } else {
+    struct Psychrometrics psychrometrics;
+    compute_psychrometrics(climate->temperature, humidity, climate->pressure, &psychrometrics);
+
+#ifdef CONFIG_HUMIDITY_CONTROL_ABSOLUTE
+    // Hold the moisture the target relative humidity would have at the target temperature, so the humidifier
+    // doesn't chase the swings in relative humidity the heater causes
+    switched = control_humidifier(psychrometrics.absolute_humidity,
+                                  absolute_humidity(TARGET_INCUBATION_TEMPERATURE, TARGET_INCUBATION_HUMIDITY - HUMIDITY_VARIANCE, climate->pressure),
+                                  absolute_humidity(TARGET_INCUBATION_TEMPERATURE, TARGET_INCUBATION_HUMIDITY + HUMIDITY_VARIANCE, climate->pressure),
+                                  " g/m^3");
+#else
+    switched = control_humidifier(humidity, TARGET_INCUBATION_HUMIDITY - HUMIDITY_VARIANCE, TARGET_INCUBATION_HUMIDITY + HUMIDITY_VARIANCE, "%");
+#endif
+
+    if (publish_due(&climate->humidity_published_us, switched)) {
+      char dew_point[8];
+      char absolute_humidity_measurement[8];
+      char vapour_pressure_deficit[8];
+      char pressure[8];
+      format_decimal(humidity_measurement, sizeof(humidity_measurement), humidity, 2);
+      format_decimal(dew_point, sizeof(dew_point), psychrometrics.dew_point, 2);
+      format_decimal(absolute_humidity_measurement, sizeof(absolute_humidity_measurement), psychrometrics.absolute_humidity, 2);
+      format_decimal(vapour_pressure_deficit, sizeof(vapour_pressure_deficit), psychrometrics.vapour_pressure_deficit, 3);
+      format_decimal(pressure, sizeof(pressure), climate->pressure, 1);
+
+      const char *keys[] = {"relative_humidity", "dew_point", "absolute_humidity", "vapour_pressure_deficit", "pressure", "sensor_address"};
+      const char *values[] = {humidity_measurement, dew_point, absolute_humidity_measurement, vapour_pressure_deficit, pressure, sensor_address};
+      publish_fields(strftime_buf, "incubator/humidity", keys, values, 6);
+    }
   }
 
-  ESP_LOGI(TAG, "Humidifier state is: %s", humidifier_state == HUMIDIFIER_ON ? "ON" : "OFF");
+  if (switched) {
+    report_switch(strftime_buf, ACTUATOR_HUMIDIFIER);
+    request_fast_sensor_reads(FAST_SAMPLING_HOLD_MS);
+  }
+
+  ESP_LOGI(TAG, "Humidifier state is: %s", actuator_is_on(ACTUATOR_HUMIDIFIER) ? "ON" : "OFF");
+  task_monitor_record_latency(LATENCY_CONTROL, esp_timer_get_time() - data->read_time_us);
+}
+
+static void request_turn(void) {
+    turn_requested_at = esp_timer_get_time();
+    xTaskNotifyGive(turner_task);
 }
 
 static void egg_turner_callback(void* arg) {
     int64_t time_since_boot = esp_timer_get_time();
     ESP_LOGI(TAG, "Periodic timer called, time since boot: %llu us", time_since_boot);
-    rotate();
+    request_turn();
+}
+
+static void egg_turner_task(void* arg) {
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        task_monitor_record_latency(LATENCY_TURNER, esp_timer_get_time() - turn_requested_at);
+        rotate();
+    }
 }
 
 void chicken_start() {
@@ -108,13 +352,19 @@ void chicken_start() {
     };
 
     set_up_uln2003();
+
+    static StaticTask_t turner_task_buffer;
+    static StackType_t turner_task_stack[TURNER_TASK_STACK_SIZE];
+    turner_task = xTaskCreateStaticPinnedToCore(&egg_turner_task, "egg_turner", TURNER_TASK_STACK_SIZE, NULL,
+                                                TURNER_TASK_PRIORITY, turner_task_stack, &turner_task_buffer,
+                                                CONTROL_CORE);
   
     esp_timer_handle_t egg_turner_timer;
     ESP_ERROR_CHECK(esp_timer_create(&egg_turner_timer_args, &egg_turner_timer));
 
     ESP_LOGI(TAG, "Number of minutes between rotations: %llu", MICROSECONDS_PER_DAY/ROTATIONS_PER_DAY/1000/1000/60);
     ESP_LOGI(TAG, "Rotating an inital time as a test");
-    rotate();
+    request_turn();
 
     ESP_ERROR_CHECK(esp_timer_start_periodic(egg_turner_timer, MICROSECONDS_PER_DAY/ROTATIONS_PER_DAY));
 }
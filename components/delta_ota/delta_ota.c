@@ -0,0 +1,207 @@
+#include "delta_ota.h"
+
+#include <string.h>
+
+#include "delta_patch.h"
+#include "esp_http_client.h"
+#include "esp_idf_version.h"
+#include "esp_image_format.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define DELTA_OTA_URL CONFIG_DELTA_OTA_URL
+#define CHECK_INTERVAL_MINUTES CONFIG_DELTA_OTA_CHECK_INTERVAL_MINUTES
+#define DOWNLOAD_BUFFER_SIZE 1024
+#define CRC_BUFFER_SIZE 1024
+// Below everything else, the control loop must always win the CPU over an update
+#define TASK_PRIORITY 2
+#define TASK_CORE CONFIG_NETWORK_CORE
+
+static const char *TAG = "delta_ota";
+
+struct DeltaOtaContext {
+  const esp_partition_t *source;
+  const esp_partition_t *target;
+  const struct DeltaPatch *patch;
+  esp_ota_handle_t ota_handle;
+  bool ota_started;
+};
+
+static uint32_t running_image_size;
+static uint32_t running_image_crc;
+
+static int read_running_image(void *context, uint32_t offset, uint8_t *buffer, size_t length) {
+  struct DeltaOtaContext *ota = (struct DeltaOtaContext *)context;
+  return esp_partition_read(ota->source, offset, buffer, length) == ESP_OK ? 0 : -1;
+}
+
+static int write_update_partition(void *context, const uint8_t *data, size_t length) {
+  struct DeltaOtaContext *ota = (struct DeltaOtaContext *)context;
+
+  // Erasing is deferred to the first write, so a delta against some other image never touches flash
+  if (!ota->ota_started) {
+    esp_err_t err = esp_ota_begin(ota->target, ota->patch->header.target_size, &ota->ota_handle);
+    if (err != ESP_OK) {
+      ESP_LOGE(TAG, "Failed to begin OTA: %s", esp_err_to_name(err));
+      return -1;
+    }
+    ota->ota_started = true;
+  }
+
+  return esp_ota_write(ota->ota_handle, data, length) == ESP_OK ? 0 : -1;
+}
+
+/**
+ * The CRC of the running image is what deltas are keyed on. It only changes with a reboot, so work it out once
+ */
+static esp_err_t compute_running_image_crc(const esp_partition_t *running) {
+  if (running_image_size != 0) {
+    return ESP_OK;
+  }
+
+  const esp_partition_pos_t position = {.offset = running->address, .size = running->size};
+  esp_image_metadata_t metadata;
+  esp_err_t err = esp_image_verify(ESP_IMAGE_VERIFY_SILENT, &position, &metadata);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to read running image metadata: %s", esp_err_to_name(err));
+    return err;
+  }
+
+  uint8_t buffer[CRC_BUFFER_SIZE];
+  uint32_t crc = 0;
+  for (uint32_t offset = 0; offset < metadata.image_len; offset += CRC_BUFFER_SIZE) {
+    size_t length = metadata.image_len - offset < CRC_BUFFER_SIZE ? metadata.image_len - offset : CRC_BUFFER_SIZE;
+    err = esp_partition_read(running, offset, buffer, length);
+    if (err != ESP_OK) {
+      return err;
+    }
+    crc = delta_crc32(crc, buffer, length);
+  }
+
+  running_image_size = metadata.image_len;
+  running_image_crc = crc;
+  ESP_LOGI(TAG, "Running image is %u bytes, CRC-32 %08x", running_image_size, running_image_crc);
+  return ESP_OK;
+}
+
+/**
+ * Streams a delta from the URL straight into the inactive OTA partition, then switches to it and reboots.
+ * Returns ESP_ERR_NOT_FOUND if there's no delta for the running image.
+ */
+esp_err_t apply_delta_ota_from_url(const char *url) {
+  const esp_partition_t *running = esp_ota_get_running_partition();
+  struct DeltaOtaContext ota = {.source = running, .target = esp_ota_get_next_update_partition(NULL)};
+  if (ota.target == NULL) {
+    ESP_LOGE(TAG, "No OTA partition to update into, check the partition table");
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  esp_err_t err = compute_running_image_crc(running);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  esp_http_client_config_t config = {.url = url, .timeout_ms = 10000};
+  esp_http_client_handle_t client = esp_http_client_init(&config);
+  err = esp_http_client_open(client, 0);
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "Failed to connect to %s: %s", url, esp_err_to_name(err));
+    esp_http_client_cleanup(client);
+    return err;
+  }
+  esp_http_client_fetch_headers(client);
+  if (esp_http_client_get_status_code(client) != 200) {
+    esp_http_client_close(client);
+    esp_http_client_cleanup(client);
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  struct DeltaPatch patch;
+  ota.patch = &patch;
+  delta_patch_init(&patch, running_image_size, running_image_crc, read_running_image, write_update_partition, &ota);
+
+  static uint8_t buffer[DOWNLOAD_BUFFER_SIZE];
+  int result = DELTA_OK;
+  int read;
+  while ((read = esp_http_client_read(client, (char *)buffer, DOWNLOAD_BUFFER_SIZE)) > 0) {
+    result = delta_patch_feed(&patch, buffer, read);
+    if (result != DELTA_OK) {
+      break;
+    }
+  }
+  if (result == DELTA_OK) {
+    result = read < 0 ? DELTA_ERR_TRUNCATED : delta_patch_finish(&patch);
+  }
+
+  esp_http_client_close(client);
+  esp_http_client_cleanup(client);
+  delta_patch_release(&patch);
+
+  if (result == DELTA_ERR_SOURCE_MISMATCH) {
+    ESP_LOGD(TAG, "Delta at %s isn't against the running image, ignoring it", url);
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  if (result != DELTA_OK) {
+    ESP_LOGE(TAG, "Failed to apply delta: %s", delta_result_name(result));
+    if (ota.ota_started) {
+      // Only releases the handle, esp_ota_end would verify the partial image and log that it failed
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 3, 0)
+      esp_ota_abort(ota.ota_handle);
+#else
+      esp_ota_end(ota.ota_handle);
+#endif
+    }
+    return ESP_FAIL;
+  }
+
+  // esp_ota_end checks the image itself (segments, checksum and SHA-256) on top of the delta's CRC
+  err = esp_ota_end(ota.ota_handle);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Patched image failed verification: %s", esp_err_to_name(err));
+    return err;
+  }
+
+  err = esp_ota_set_boot_partition(ota.target);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to set boot partition: %s", esp_err_to_name(err));
+    return err;
+  }
+
+  ESP_LOGI(TAG, "Update written to %s (%u bytes), restarting", ota.target->label, patch.header.target_size);
+  esp_restart();
+  return ESP_OK;
+}
+
+static void delta_ota_task(void *arg) {
+  while (true) {
+    apply_delta_ota_from_url(DELTA_OTA_URL);
+    vTaskDelay((CHECK_INTERVAL_MINUTES * 60 * 1000) / portTICK_PERIOD_MS);
+  }
+}
+
+void start_delta_ota_updates(void) {
+  if (strlen(DELTA_OTA_URL) == 0) {
+    ESP_LOGI(TAG, "No delta OTA URL configured, not checking for updates");
+    return;
+  }
+  ESP_LOGI(TAG, "Checking %s for updates every %d minutes", DELTA_OTA_URL, CHECK_INTERVAL_MINUTES);
+  xTaskCreatePinnedToCore(&delta_ota_task, "delta_ota", 6144, NULL, TASK_PRIORITY, NULL, TASK_CORE);
+}
+
+/**
+ * A freshly updated image boots on probation. If it resets before getting here, the bootloader rolls
+ * back to the previous image.
+ */
+void mark_running_image_valid(void) {
+  esp_ota_img_states_t state;
+  if (esp_ota_get_state_partition(esp_ota_get_running_partition(), &state) == ESP_OK &&
+      state == ESP_OTA_IMG_PENDING_VERIFY) {
+    ESP_LOGI(TAG, "Update booted successfully, cancelling rollback");
+    ESP_ERROR_CHECK(esp_ota_mark_app_valid_cancel_rollback());
+  }
+}
@@ -0,0 +1,10 @@
+#ifndef delta_ota_h
+#define delta_ota_h
+
+#include "esp_err.h"
+
+esp_err_t apply_delta_ota_from_url(const char* url);
+void start_delta_ota_updates(void);
+void mark_running_image_valid(void);
+
+#endif
@@ -0,0 +1,380 @@
+#include "delta_patch.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+// The ROM has tinfl, so inflating costs no flash
+#include "esp32/rom/miniz.h"
+#else
+#include <zlib.h>
+#endif
+
+#define COPY_CHUNK_SIZE 256
+#define MAX_VARINT_SHIFT 63
+#define INFLATE_CHUNK_SIZE 1024
+
+struct DeltaInflater {
+#ifdef ESP_PLATFORM
+  tinfl_decompressor decompressor;
+  // tinfl inflates straight into its window, which wraps
+  size_t window_position;
+  uint8_t window[TINFL_LZ_DICT_SIZE];
+#else
+  z_stream stream;
+  uint8_t output[INFLATE_CHUNK_SIZE];
+#endif
+  bool finished;
+};
+
+// Nibble-at-a-time table, small enough to not matter on the device and still quick over a whole image
+static const uint32_t crc32_nibble_table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C};
+
+uint32_t delta_crc32(uint32_t crc, const uint8_t *data, size_t length) {
+  crc = ~crc;
+  for (size_t i = 0; i < length; i++) {
+    crc = crc32_nibble_table[(crc ^ data[i]) & 0x0F] ^ (crc >> 4);
+    crc = crc32_nibble_table[(crc ^ (data[i] >> 4)) & 0x0F] ^ (crc >> 4);
+  }
+  return ~crc;
+}
+
+static uint32_t read_u32(const uint8_t *bytes) {
+  return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+void delta_patch_init(struct DeltaPatch *patch, uint32_t source_size, uint32_t source_crc,
+                      delta_read_source_t read_source, delta_write_target_t write_target, void *context) {
+  memset(patch, 0, sizeof(*patch));
+  patch->read_source = read_source;
+  patch->write_target = write_target;
+  patch->context = context;
+  patch->expected_source_size = source_size;
+  patch->expected_source_crc = source_crc;
+  patch->state = DELTA_STATE_HEADER;
+}
+
+static int write_target(struct DeltaPatch *patch, const uint8_t *data, size_t length) {
+  if (length > patch->header.target_size - patch->written) {
+    return DELTA_ERR_OUT_OF_RANGE;
+  }
+  if (patch->write_target(patch->context, data, length) != 0) {
+    return DELTA_ERR_WRITE;
+  }
+  patch->crc = delta_crc32(patch->crc, data, length);
+  patch->written += length;
+  return DELTA_OK;
+}
+
+static int start_inflater(struct DeltaPatch *patch) {
+  patch->inflater = calloc(1, sizeof(struct DeltaInflater));
+  if (patch->inflater == NULL) {
+    return DELTA_ERR_NO_MEMORY;
+  }
+#ifdef ESP_PLATFORM
+  tinfl_init(&patch->inflater->decompressor);
+#else
+  // Negative window bits for a raw stream, without the zlib header
+  if (inflateInit2(&patch->inflater->stream, -15) != Z_OK) {
+    free(patch->inflater);
+    patch->inflater = NULL;
+    return DELTA_ERR_NO_MEMORY;
+  }
+#endif
+  return DELTA_OK;
+}
+
+static int parse_header(struct DeltaPatch *patch) {
+  const uint8_t *bytes = patch->header_bytes;
+  if (memcmp(bytes, DELTA_MAGIC, 4) != 0 ||
+      (bytes[4] != DELTA_VERSION_UNCOMPRESSED && bytes[4] != DELTA_VERSION_COMPRESSED)) {
+    return DELTA_ERR_BAD_HEADER;
+  }
+
+  patch->header.source_size = read_u32(bytes + 8);
+  patch->header.source_crc = read_u32(bytes + 12);
+  patch->header.target_size = read_u32(bytes + 16);
+  patch->header.target_crc = read_u32(bytes + 20);
+
+  if (patch->header.source_size != patch->expected_source_size ||
+      patch->header.source_crc != patch->expected_source_crc) {
+    return DELTA_ERR_SOURCE_MISMATCH;
+  }
+  return bytes[4] == DELTA_VERSION_COMPRESSED ? start_inflater(patch) : DELTA_OK;
+}
+
+static int copy_from_source(struct DeltaPatch *patch, uint32_t length) {
+  if (patch->copy_offset < 0 || (uint64_t)patch->copy_offset + length > patch->header.source_size) {
+    return DELTA_ERR_OUT_OF_RANGE;
+  }
+
+  uint8_t buffer[COPY_CHUNK_SIZE];
+  uint32_t offset = (uint32_t)patch->copy_offset;
+  while (length > 0) {
+    size_t chunk = length < COPY_CHUNK_SIZE ? length : COPY_CHUNK_SIZE;
+    if (patch->read_source(patch->context, offset, buffer, chunk) != 0) {
+      return DELTA_ERR_READ;
+    }
+    int result = write_target(patch, buffer, chunk);
+    if (result != DELTA_OK) {
+      return result;
+    }
+    offset += chunk;
+    length -= chunk;
+  }
+  patch->source_position = offset;
+  return DELTA_OK;
+}
+
+/* Accumulates one LEB128 byte, returns 1 once the varint is complete */
+static int take_varint_byte(struct DeltaPatch *patch, uint8_t byte, int *result) {
+  if (patch->varint_shift > MAX_VARINT_SHIFT) {
+    *result = DELTA_ERR_BAD_OP;
+    return 0;
+  }
+  patch->varint |= (uint64_t)(byte & 0x7F) << patch->varint_shift;
+  patch->varint_shift += 7;
+  return (byte & 0x80) == 0;
+}
+
+static void reset_varint(struct DeltaPatch *patch) {
+  patch->varint = 0;
+  patch->varint_shift = 0;
+}
+
+static enum DeltaPatchState next_op_state(struct DeltaPatch *patch) {
+  return patch->written == patch->header.target_size ? DELTA_STATE_DONE : DELTA_STATE_OP;
+}
+
+/* Runs the operations, as they come out of the inflater for compressed deltas */
+static int feed_ops(struct DeltaPatch *patch, const uint8_t *data, size_t length) {
+  size_t i = 0;
+  int result = DELTA_OK;
+
+  while (i < length) {
+    switch (patch->state) {
+      case DELTA_STATE_OP:
+        reset_varint(patch);
+        if (data[i] == DELTA_OP_COPY) {
+          patch->state = DELTA_STATE_COPY_OFFSET;
+        } else if (data[i] == DELTA_OP_INSERT) {
+          patch->state = DELTA_STATE_INSERT_LENGTH;
+        } else {
+          return DELTA_ERR_BAD_OP;
+        }
+        i++;
+        break;
+
+      case DELTA_STATE_COPY_OFFSET:
+        if (take_varint_byte(patch, data[i++], &result)) {
+          int64_t relative = (int64_t)(patch->varint >> 1) ^ -(int64_t)(patch->varint & 1);
+          patch->copy_offset = (int64_t)patch->source_position + relative;
+          reset_varint(patch);
+          patch->state = DELTA_STATE_COPY_LENGTH;
+        }
+        break;
+
+      case DELTA_STATE_COPY_LENGTH:
+        if (take_varint_byte(patch, data[i++], &result)) {
+          if (patch->varint > UINT32_MAX) {
+            return DELTA_ERR_OUT_OF_RANGE;
+          }
+          result = copy_from_source(patch, (uint32_t)patch->varint);
+          if (result != DELTA_OK) {
+            return result;
+          }
+          patch->state = next_op_state(patch);
+        }
+        break;
+
+      case DELTA_STATE_INSERT_LENGTH:
+        if (take_varint_byte(patch, data[i++], &result)) {
+          if (patch->varint == 0 || patch->varint > patch->header.target_size - patch->written) {
+            return DELTA_ERR_OUT_OF_RANGE;
+          }
+          patch->remaining = (uint32_t)patch->varint;
+          patch->state = DELTA_STATE_INSERT_DATA;
+        }
+        break;
+
+      case DELTA_STATE_INSERT_DATA: {
+        size_t available = length - i < patch->remaining ? length - i : patch->remaining;
+        result = write_target(patch, data + i, available);
+        if (result != DELTA_OK) {
+          return result;
+        }
+        patch->remaining -= available;
+        i += available;
+        if (patch->remaining == 0) {
+          patch->state = next_op_state(patch);
+        }
+        break;
+      }
+
+      case DELTA_STATE_HEADER:
+      case DELTA_STATE_DONE:
+        // Anything after the last operation means the delta isn't what we think it is
+        return DELTA_ERR_BAD_OP;
+    }
+
+    if (result != DELTA_OK) {
+      return result;
+    }
+  }
+
+  return DELTA_OK;
+}
+
+#ifdef ESP_PLATFORM
+static int inflate_ops(struct DeltaPatch *patch, const uint8_t *data, size_t length) {
+  struct DeltaInflater *inflater = patch->inflater;
+  while (true) {
+    size_t in_size = length;
+    size_t out_size = TINFL_LZ_DICT_SIZE - inflater->window_position;
+    tinfl_status status =
+        tinfl_decompress(&inflater->decompressor, data, &in_size, inflater->window,
+                         inflater->window + inflater->window_position, &out_size, TINFL_FLAG_HAS_MORE_INPUT);
+    data += in_size;
+    length -= in_size;
+    if (status < TINFL_STATUS_DONE) {
+      return DELTA_ERR_INFLATE;
+    }
+
+    int result = feed_ops(patch, inflater->window + inflater->window_position, out_size);
+    if (result != DELTA_OK) {
+      return result;
+    }
+    inflater->window_position = (inflater->window_position + out_size) & (TINFL_LZ_DICT_SIZE - 1);
+
+    if (status == TINFL_STATUS_DONE) {
+      inflater->finished = true;
+      return length == 0 ? DELTA_OK : DELTA_ERR_INFLATE;
+    }
+    if (status == TINFL_STATUS_NEEDS_MORE_INPUT) {
+      return DELTA_OK;
+    }
+  }
+}
+#else
+static int inflate_ops(struct DeltaPatch *patch, const uint8_t *data, size_t length) {
+  struct DeltaInflater *inflater = patch->inflater;
+  inflater->stream.next_in = (uint8_t *)data;
+  inflater->stream.avail_in = length;
+  while (true) {
+    inflater->stream.next_out = inflater->output;
+    inflater->stream.avail_out = INFLATE_CHUNK_SIZE;
+    int status = inflate(&inflater->stream, Z_NO_FLUSH);
+    if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR) {
+      return DELTA_ERR_INFLATE;
+    }
+
+    int result = feed_ops(patch, inflater->output, INFLATE_CHUNK_SIZE - inflater->stream.avail_out);
+    if (result != DELTA_OK) {
+      return result;
+    }
+
+    if (status == Z_STREAM_END) {
+      inflater->finished = true;
+      return inflater->stream.avail_in == 0 ? DELTA_OK : DELTA_ERR_INFLATE;
+    }
+    // Room left over means the input ran out first
+    if (inflater->stream.avail_out != 0) {
+      return DELTA_OK;
+    }
+  }
+}
+#endif
+
+/**
+ * Consumes the next piece of the delta, whatever its size. Target bytes are written as soon as they're known.
+ */
+int delta_patch_feed(struct DeltaPatch *patch, const uint8_t *data, size_t length) {
+  if (patch->state == DELTA_STATE_HEADER) {
+    size_t wanted = DELTA_HEADER_SIZE - patch->header_length;
+    size_t available = length < wanted ? length : wanted;
+    memcpy(patch->header_bytes + patch->header_length, data, available);
+    patch->header_length += available;
+    data += available;
+    length -= available;
+    if (patch->header_length < DELTA_HEADER_SIZE) {
+      return DELTA_OK;
+    }
+    int result = parse_header(patch);
+    if (result != DELTA_OK) {
+      return result;
+    }
+    patch->state = next_op_state(patch);
+  }
+
+  if (length == 0) {
+    return DELTA_OK;
+  }
+  if (patch->inflater != NULL) {
+    // The stream's end is data too, so it's fed even once the target is complete
+    return patch->inflater->finished ? DELTA_ERR_INFLATE : inflate_ops(patch, data, length);
+  }
+  return feed_ops(patch, data, length);
+}
+
+/**
+ * Checks the whole target was produced and matches the CRC the delta promised
+ */
+int delta_patch_finish(struct DeltaPatch *patch) {
+  if (patch->state != DELTA_STATE_DONE) {
+    return patch->state == DELTA_STATE_HEADER && patch->header_length < DELTA_HEADER_SIZE ? DELTA_ERR_BAD_HEADER
+                                                                                          : DELTA_ERR_TRUNCATED;
+  }
+  if (patch->inflater != NULL && !patch->inflater->finished) {
+    return DELTA_ERR_TRUNCATED;
+  }
+  if (patch->crc != patch->header.target_crc) {
+    return DELTA_ERR_TARGET_MISMATCH;
+  }
+  return DELTA_OK;
+}
+
+/**
+ * Frees the inflater, whether or not the patch got anywhere. Safe to call more than once.
+ */
+void delta_patch_release(struct DeltaPatch *patch) {
+  if (patch->inflater == NULL) {
+    return;
+  }
+#ifndef ESP_PLATFORM
+  inflateEnd(&patch->inflater->stream);
+#endif
+  free(patch->inflater);
+  patch->inflater = NULL;
+}
+
+const char *delta_result_name(int result) {
+  switch (result) {
+    case DELTA_OK:
+      return "ok";
+    case DELTA_ERR_BAD_HEADER:
+      return "bad header";
+    case DELTA_ERR_SOURCE_MISMATCH:
+      return "delta is not against the running image";
+    case DELTA_ERR_BAD_OP:
+      return "bad operation";
+    case DELTA_ERR_OUT_OF_RANGE:
+      return "operation out of range";
+    case DELTA_ERR_READ:
+      return "failed to read source";
+    case DELTA_ERR_WRITE:
+      return "failed to write target";
+    case DELTA_ERR_TRUNCATED:
+      return "delta ended early";
+    case DELTA_ERR_TARGET_MISMATCH:
+      return "target CRC mismatch";
+    case DELTA_ERR_INFLATE:
+      return "bad compressed data";
+    case DELTA_ERR_NO_MEMORY:
+      return "out of memory";
+    default:
+      return "unknown";
+  }
+}
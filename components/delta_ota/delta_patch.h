@@ -0,0 +1,105 @@
+#ifndef delta_patch_h
+#define delta_patch_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Streaming applier for firmware deltas. Doesn't depend on ESP-IDF, so the same code
+ * applies patches on the device and in tools/delta_tool on the host. Only the inflater differs,
+ * the device uses the one in ROM and the host zlib.
+ *
+ * A delta is a 24 byte header followed by operations, all little-endian:
+ *
+ *   "IDLT" | version (1 byte) | 3 reserved bytes
+ *   source size (u32) | source CRC-32 (u32) | target size (u32) | target CRC-32 (u32)
+ *
+ *   DELTA_OP_COPY:   varint zigzag(source offset - end of the previous copy), varint length
+ *   DELTA_OP_INSERT: varint length, then that many literal bytes
+ *
+ * Copies reference the running image, so only changed bytes travel over the network. In version 2
+ * the operations are one raw deflate stream (32 KB window), which mostly shrinks the inserted bytes.
+ * Version 1 deltas, with the operations as they are, are still applied for devices updating from
+ * firmware that predates compression.
+ */
+
+#define DELTA_MAGIC "IDLT"
+#define DELTA_VERSION_UNCOMPRESSED 1
+#define DELTA_VERSION_COMPRESSED 2
+#define DELTA_HEADER_SIZE 24
+
+enum DeltaOp {
+  DELTA_OP_COPY = 0,
+  DELTA_OP_INSERT = 1
+};
+
+enum DeltaResult {
+  DELTA_OK = 0,
+  DELTA_ERR_BAD_HEADER = -1,
+  DELTA_ERR_SOURCE_MISMATCH = -2,
+  DELTA_ERR_BAD_OP = -3,
+  DELTA_ERR_OUT_OF_RANGE = -4,
+  DELTA_ERR_READ = -5,
+  DELTA_ERR_WRITE = -6,
+  DELTA_ERR_TRUNCATED = -7,
+  DELTA_ERR_TARGET_MISMATCH = -8,
+  DELTA_ERR_INFLATE = -9,
+  DELTA_ERR_NO_MEMORY = -10
+};
+
+typedef int (*delta_read_source_t)(void* context, uint32_t offset, uint8_t* buffer, size_t length);
+typedef int (*delta_write_target_t)(void* context, const uint8_t* data, size_t length);
+
+enum DeltaPatchState {
+  DELTA_STATE_HEADER,
+  DELTA_STATE_OP,
+  DELTA_STATE_COPY_OFFSET,
+  DELTA_STATE_COPY_LENGTH,
+  DELTA_STATE_INSERT_LENGTH,
+  DELTA_STATE_INSERT_DATA,
+  DELTA_STATE_DONE
+};
+
+struct DeltaHeader {
+  uint32_t source_size;
+  uint32_t source_crc;
+  uint32_t target_size;
+  uint32_t target_crc;
+};
+
+struct DeltaInflater;
+
+struct DeltaPatch {
+  delta_read_source_t read_source;
+  delta_write_target_t write_target;
+  void* context;
+  uint32_t expected_source_size;
+  uint32_t expected_source_crc;
+
+  enum DeltaPatchState state;
+  struct DeltaHeader header;
+  // Only for compressed deltas, allocated once the header matches the running image
+  struct DeltaInflater* inflater;
+  uint8_t header_bytes[DELTA_HEADER_SIZE];
+  size_t header_length;
+
+  uint64_t varint;
+  int varint_shift;
+  int64_t copy_offset;
+  uint32_t source_position;
+  uint32_t remaining;
+
+  uint32_t written;
+  uint32_t crc;
+};
+
+uint32_t delta_crc32(uint32_t crc, const uint8_t* data, size_t length);
+
+void delta_patch_init(struct DeltaPatch* patch, uint32_t source_size, uint32_t source_crc,
+                      delta_read_source_t read_source, delta_write_target_t write_target, void* context);
+int delta_patch_feed(struct DeltaPatch* patch, const uint8_t* data, size_t length);
+int delta_patch_finish(struct DeltaPatch* patch);
+void delta_patch_release(struct DeltaPatch* patch);
+const char* delta_result_name(int result);
+
+#endif
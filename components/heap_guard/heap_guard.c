@@ -0,0 +1,132 @@
+#include "heap_guard.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#ifdef CONFIG_ZERO_HEAP_STEADY_STATE
+
+#define WARMUP_CYCLES CONFIG_HEAP_GUARD_WARMUP_CYCLES
+#define MAX_WATCHED_TASKS 6
+
+static const char *TAG = "heap_guard";
+
+struct WatchedTask {
+  TaskHandle_t task;
+  // Only ever incremented by the task itself, from inside the allocator
+  volatile uint32_t allocations;
+  uint32_t allocations_at_last_cycle;
+  uint32_t cycles;
+};
+
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+static struct WatchedTask watched[MAX_WATCHED_TASKS];
+static volatile int watched_count;
+static volatile uint32_t steady_state_allocations;
+
+static struct WatchedTask *find_watched(TaskHandle_t task) {
+  for (int i = 0; i < watched_count; i++) {
+    if (watched[i].task == task) {
+      return &watched[i];
+    }
+  }
+  return NULL;
+}
+
+// Runs inside every allocation, so nothing in here may allocate (or log)
+static void count_allocation(void) {
+  if (watched_count == 0) {
+    return;
+  }
+  struct WatchedTask *current = find_watched(xTaskGetCurrentTaskHandle());
+  if (current != NULL) {
+    current->allocations++;
+  }
+}
+
+void *__real_heap_caps_malloc(size_t size, uint32_t caps);
+void *__real_heap_caps_calloc(size_t n, size_t size, uint32_t caps);
+void *__real_heap_caps_realloc(void *ptr, size_t size, uint32_t caps);
+void *__real_heap_caps_malloc_default(size_t size);
+void *__real_heap_caps_realloc_default(void *ptr, size_t size);
+
+void *__wrap_heap_caps_malloc(size_t size, uint32_t caps) {
+  count_allocation();
+  return __real_heap_caps_malloc(size, caps);
+}
+
+void *__wrap_heap_caps_calloc(size_t n, size_t size, uint32_t caps) {
+  count_allocation();
+  return __real_heap_caps_calloc(n, size, caps);
+}
+
+void *__wrap_heap_caps_realloc(void *ptr, size_t size, uint32_t caps) {
+  count_allocation();
+  return __real_heap_caps_realloc(ptr, size, caps);
+}
+
+void *__wrap_heap_caps_malloc_default(size_t size) {
+  count_allocation();
+  return __real_heap_caps_malloc_default(size);
+}
+
+void *__wrap_heap_caps_realloc_default(void *ptr, size_t size) {
+  count_allocation();
+  return __real_heap_caps_realloc_default(ptr, size);
+}
+
+void heap_guard_watch_current_task(void) {
+  TaskHandle_t task = xTaskGetCurrentTaskHandle();
+
+  portENTER_CRITICAL(&lock);
+  bool added = find_watched(task) == NULL && watched_count < MAX_WATCHED_TASKS;
+  if (added) {
+    watched[watched_count] = (struct WatchedTask){.task = task};
+    watched_count++;
+  }
+  portEXIT_CRITICAL(&lock);
+
+  if (added) {
+    ESP_LOGI(TAG, "Watching %s for heap allocations", pcTaskGetTaskName(task));
+  } else if (find_watched(task) == NULL) {
+    ESP_LOGE(TAG, "Can't watch %s, already watching %d tasks", pcTaskGetTaskName(task), MAX_WATCHED_TASKS);
+  }
+}
+
+/**
+ * Checks the calling task hasn't allocated since its last cycle ended. Warm-up cycles are let off.
+ */
+void heap_guard_end_cycle(void) {
+  struct WatchedTask *current = find_watched(xTaskGetCurrentTaskHandle());
+  if (current == NULL) {
+    return;
+  }
+
+  uint32_t allocations = current->allocations - current->allocations_at_last_cycle;
+  current->allocations_at_last_cycle = current->allocations;
+  current->cycles++;
+  if (allocations == 0 || current->cycles <= WARMUP_CYCLES) {
+    return;
+  }
+
+  steady_state_allocations += allocations;
+  ESP_LOGE(TAG, "%s made %u heap allocations in cycle %u", pcTaskGetTaskName(NULL), allocations, current->cycles);
+#ifdef CONFIG_HEAP_GUARD_ABORT_ON_ALLOCATION
+  abort();
+#endif
+}
+
+uint32_t heap_guard_steady_state_allocations(void) { return steady_state_allocations; }
+
+#else
+
+void heap_guard_watch_current_task(void) {}
+
+void heap_guard_end_cycle(void) {}
+
+uint32_t heap_guard_steady_state_allocations(void) { return 0; }
+
+#endif
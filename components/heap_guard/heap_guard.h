@@ -0,0 +1,16 @@
+#ifndef heap_guard_h
+#define heap_guard_h
+
+#include <stdint.h>
+
+/*
+ * Counts heap allocations made by watched tasks, so CONFIG_ZERO_HEAP_STEADY_STATE can be held to its word.
+ * A task calls heap_guard_watch_current_task() once its own setup is done, then heap_guard_end_cycle() at the
+ * end of every loop. Without CONFIG_ZERO_HEAP_STEADY_STATE these do nothing.
+ */
+
+void heap_guard_watch_current_task(void);
+void heap_guard_end_cycle(void);
+uint32_t heap_guard_steady_state_allocations(void);
+
+#endif
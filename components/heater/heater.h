@@ -1,8 +0,0 @@
-#ifndef heater_h
-#define heater_h
-
-void initialize_heater();
-void turn_on_heater();
-void turn_off_heater();
-
-#endif
@@ -1,8 +0,0 @@
-#ifndef humidifier_h
-#define humidifier_h
-
-void initialize_humidifier();
-void turn_on_humidifier();
-void turn_off_humidifier();
-
-#endif
@@ -1,14 +1,23 @@
 #include "mqtt_helper.h"
 
 #include <esp_log.h>
+#include <stdio.h>
+#include <string.h>
 
-#include "cJSON.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
 #include "mqtt_client.h"
 #include "stdatomic.h"
 
 #define MQTT_BROKER_URL CONFIG_MQTT_BROKER_URL
+#define PUBLISH_POOL_SIZE CONFIG_MQTT_PUBLISH_POOL_SIZE
+#define MAX_TOPIC_LENGTH 32
+#define MAX_PAYLOAD_LENGTH 384
+#define PUBLISH_TASK_STACK_SIZE 3072
+#define PUBLISH_TASK_PRIORITY 4
+#define PUBLISH_TASK_CORE CONFIG_NETWORK_CORE
 
 static const char *TAG = "mqtt_helper";
 
@@ -20,11 +29,79 @@ static EventGroupHandle_t mqtt_event_group;
 
 enum mqtt_qos { AT_MOST_ONCE, AT_LEAST_ONCE, EXACTLY_ONCE };
 
-cJSON *root;
-cJSON *time_string;
-cJSON *mac_string;
 atomic_ushort outstanding_messages = 0;
 
+static char mac_as_text[18];
+
+/* Messages are encoded straight into slots from a fixed pool and handed to the publisher task by index,
+ * so publishing from a control handler never allocates or waits on the network. */
+struct OutgoingMessage {
+  char topic[MAX_TOPIC_LENGTH];
+  char payload[MAX_PAYLOAD_LENGTH];
+  size_t length;
+  // Told whether the client took it, for publish_fields_confirmed. NULL for everything else.
+  TaskHandle_t confirm_to;
+};
+
+enum PublishOutcome { PUBLISH_SENT = 1, PUBLISH_DROPPED };
+
+static struct OutgoingMessage message_pool[PUBLISH_POOL_SIZE];
+
+static QueueHandle_t free_messages;
+static StaticQueue_t free_messages_buffer;
+static uint8_t free_messages_storage[PUBLISH_POOL_SIZE * sizeof(uint8_t)];
+
+static QueueHandle_t ready_messages;
+static StaticQueue_t ready_messages_buffer;
+static uint8_t ready_messages_storage[PUBLISH_POOL_SIZE * sizeof(uint8_t)];
+
+static StaticTask_t publish_task_buffer;
+static StackType_t publish_task_stack[PUBLISH_TASK_STACK_SIZE];
+
+// Appends to a fixed buffer, remembering if anything didn't fit rather than writing past the end
+struct JsonWriter {
+  char *buffer;
+  size_t size;
+  size_t length;
+  bool overflowed;
+};
+
+static void json_append_char(struct JsonWriter *writer, char c) {
+  if (writer->length + 1 < writer->size) {
+    writer->buffer[writer->length++] = c;
+  } else {
+    writer->overflowed = true;
+  }
+}
+
+static void json_append_string(struct JsonWriter *writer, const char *text) {
+  json_append_char(writer, '"');
+  for (const char *c = text; *c != '\0'; c++) {
+    if (*c == '"' || *c == '\\') {
+      json_append_char(writer, '\\');
+      json_append_char(writer, *c);
+    } else if ((unsigned char)*c < 0x20) {
+      char escaped[7];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", *c);
+      for (int i = 0; escaped[i] != '\0'; i++) {
+        json_append_char(writer, escaped[i]);
+      }
+    } else {
+      json_append_char(writer, *c);
+    }
+  }
+  json_append_char(writer, '"');
+}
+
+static void json_append_field(struct JsonWriter *writer, const char *key, const char *value) {
+  if (writer->length > 1) {
+    json_append_char(writer, ',');
+  }
+  json_append_string(writer, key);
+  json_append_char(writer, ':');
+  json_append_string(writer, value);
+}
+
 static esp_err_t mqtt_event_handler_cb(esp_mqtt_event_handle_t event) {
   switch (event->event_id) {
     case MQTT_EVENT_CONNECTED:
@@ -33,6 +110,7 @@ static esp_err_t mqtt_event_handler_cb(esp_mqtt_event_handle_t event) {
       break;
     case MQTT_EVENT_DISCONNECTED:
       ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
+      xEventGroupClearBits(mqtt_event_group, MQTT_CONNECTED);
       break;
     case MQTT_EVENT_SUBSCRIBED:
       ESP_LOGI(TAG, "MQTT_EVENT_SUBSCRIBED, msg_id=%d", event->msg_id);
@@ -66,25 +144,68 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
   mqtt_event_handler_cb(event_data);
 }
 
+static void publish_task(void *arg) {
+  uint8_t index;
+  while (true) {
+    xQueueReceive(ready_messages, &index, portMAX_DELAY);
+    struct OutgoingMessage *message = &message_pool[index];
+    // The connection may have dropped while it was queued, the client would hold onto it in the heap
+    bool sent = false;
+    if (xEventGroupGetBits(mqtt_event_group) & MQTT_CONNECTED) {
+      sent = esp_mqtt_client_publish(client, message->topic, message->payload, message->length, EXACTLY_ONCE,
+                                     RETAIN) >= 0;
+      if (sent) {
+        outstanding_messages++;
+      }
+    }
+    TaskHandle_t confirm_to = message->confirm_to;
+    xQueueSend(free_messages, &index, 0);
+    if (confirm_to != NULL) {
+      xTaskNotify(confirm_to, sent ? PUBLISH_SENT : PUBLISH_DROPPED, eSetValueWithOverwrite);
+    }
+  }
+}
+
 void initialize_mqtt(void) {
   esp_mqtt_client_config_t mqtt_cfg = {
       .uri = MQTT_BROKER_URL,
   };
 
+  // Created first, the client can connect (and fire events) as soon as it's started
+  mqtt_event_group = xEventGroupCreate();
+
+  uint8_t mac[6];
+  ESP_ERROR_CHECK(esp_efuse_mac_get_default(mac));
+  snprintf(mac_as_text, sizeof(mac_as_text), "%02x:%02x:%02x:%02x:%02x:%02x", mac[0], mac[1], mac[2], mac[3], mac[4],
+           mac[5]);
+
+  free_messages = xQueueCreateStatic(PUBLISH_POOL_SIZE, sizeof(uint8_t), free_messages_storage, &free_messages_buffer);
+  ready_messages = xQueueCreateStatic(PUBLISH_POOL_SIZE, sizeof(uint8_t), ready_messages_storage, &ready_messages_buffer);
+  for (uint8_t i = 0; i < PUBLISH_POOL_SIZE; i++) {
+    xQueueSend(free_messages, &i, 0);
+  }
+  xTaskCreateStaticPinnedToCore(&publish_task, "mqtt_publish", PUBLISH_TASK_STACK_SIZE, NULL, PUBLISH_TASK_PRIORITY,
+                                publish_task_stack, &publish_task_buffer, PUBLISH_TASK_CORE);
+
   client = esp_mqtt_client_init(&mqtt_cfg);
 
   esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, client);
 
   esp_mqtt_client_start(client);
+}
 
-  mqtt_event_group = xEventGroupCreate();
+bool wait_for_mqtt_to_connect(uint32_t timeout_ms) {
+  ESP_LOGI(TAG, "Waiting up to %u ms for MQTT client to connect", timeout_ms);
+  EventBits_t bits = xEventGroupWaitBits(mqtt_event_group, MQTT_CONNECTED, false, true, pdMS_TO_TICKS(timeout_ms));
+  if (bits & MQTT_CONNECTED) {
+    ESP_LOGI(TAG, "MQTT client connected!");
+    return true;
+  }
+  return false;
 }
 
-void wait_for_mqtt_to_connect() {
-  ESP_LOGI(TAG, "Waiting for MQTT client to connect");
-  xEventGroupWaitBits(mqtt_event_group, MQTT_CONNECTED, false, true, portMAX_DELAY);
-  xEventGroupClearBits(mqtt_event_group, MQTT_CONNECTED);
-  ESP_LOGI(TAG, "MQTT client connected!");
+bool mqtt_is_connected(void) {
+  return mqtt_event_group != NULL && (xEventGroupGetBits(mqtt_event_group) & MQTT_CONNECTED);
 }
 
 void wait_for_all_messages_to_be_published(void) {
@@ -100,27 +221,72 @@ void wait_for_all_messages_to_be_published(void) {
   }
 }
 
-void publish_message(char datetime[], char topic[], char key[], char payload[]) {
-  root = cJSON_CreateObject();
-  cJSON_AddItemToObject(root, "datetime", cJSON_CreateString(datetime));
+bool publish_message(char datetime[], char topic[], char key[], char payload[]) {
+  const char *keys[] = {key};
+  const char *values[] = {payload};
+  return publish_fields(datetime, topic, keys, values, 1);
+}
+
+static bool queue_fields(char datetime[], char topic[], const char *keys[], const char *values[], int count,
+                         TaskHandle_t confirm_to) {
+  // Nothing is queued while the broker is unreachable, an outage would otherwise fill the heap with old readings
+  if (!mqtt_is_connected()) {
+    ESP_LOGD(TAG, "Not connected, dropping message for %s", topic);
+    return false;
+  }
 
-  uint8_t mac[6];
-  char mac_as_text[18];
-  ESP_ERROR_CHECK(esp_efuse_mac_get_default(mac));
-  sprintf(mac_as_text, "%02x:%02x:%02x:%02x:%02x:%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-  cJSON_AddItemToObject(root, "mac", cJSON_CreateString(mac_as_text));
+  uint8_t index;
+  if (xQueueReceive(free_messages, &index, 0) != pdTRUE) {
+    ESP_LOGW(TAG, "All %d messages in the pool are waiting to be published, dropping message for %s",
+             PUBLISH_POOL_SIZE, topic);
+    return false;
+  }
+  struct OutgoingMessage *message = &message_pool[index];
 
-  cJSON_AddItemToObject(root, key, cJSON_CreateString(payload));
+  struct JsonWriter writer = {.buffer = message->payload, .size = sizeof(message->payload)};
+  json_append_char(&writer, '{');
+  json_append_field(&writer, "datetime", datetime);
+  json_append_field(&writer, "mac", mac_as_text);
+  for (int i = 0; i < count; i++) {
+    json_append_field(&writer, keys[i], values[i]);
+  }
+  json_append_char(&writer, '}');
+  writer.buffer[writer.length] = '\0';
 
-  char *json_as_string;
+  if (writer.overflowed || strlen(topic) >= sizeof(message->topic)) {
+    ESP_LOGE(TAG, "Message for %s doesn't fit in %d bytes, dropping it", topic, MAX_PAYLOAD_LENGTH);
+    xQueueSend(free_messages, &index, 0);
+    return false;
+  }
+  strcpy(message->topic, topic);
+  message->length = writer.length;
+  message->confirm_to = confirm_to;
+  ESP_LOGI(TAG, "%s", message->payload);
 
-  json_as_string = cJSON_Print(root);
-  ESP_LOGI(TAG, "\n%s", json_as_string);
+  xQueueSend(ready_messages, &index, 0);
+  return true;
+}
 
-  esp_mqtt_client_publish(client, topic, json_as_string, 0, EXACTLY_ONCE, RETAIN);
-  outstanding_messages++;
-  free(json_as_string);
+/**
+ * Returns whether the message was queued. It can still be dropped if the connection goes before the publisher
+ * task gets to it.
+ */
+bool publish_fields(char datetime[], char topic[], const char *keys[], const char *values[], int count) {
+  return queue_fields(datetime, topic, keys, values, count, NULL);
+}
 
-  /* free all objects under root and root itself */
-  cJSON_Delete(root);
+/**
+ * Waits up to timeout_ms for the publisher task to hand the message to the client, where QoS 2 takes over, and
+ * returns whether it did. For messages that mustn't be lost, the caller keeps them until this says they're out.
+ * Uses the calling task's notification value.
+ */
+bool publish_fields_confirmed(char datetime[], char topic[], const char *keys[], const char *values[], int count,
+                              uint32_t timeout_ms) {
+  // A confirmation left over from an earlier call that timed out isn't this one's
+  xTaskNotifyWait(0, UINT32_MAX, NULL, 0);
+  if (!queue_fields(datetime, topic, keys, values, count, xTaskGetCurrentTaskHandle())) {
+    return false;
+  }
+  uint32_t outcome;
+  return xTaskNotifyWait(0, UINT32_MAX, &outcome, pdMS_TO_TICKS(timeout_ms)) == pdTRUE && outcome == PUBLISH_SENT;
 }
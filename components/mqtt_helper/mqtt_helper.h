@@ -1,11 +1,16 @@
 #ifndef mqtt_helper_h
 #define mqtt_helper_h
 
+#include <stdbool.h>
 #include <stdint.h>
 
 void initialize_mqtt(void);
-void wait_for_mqtt_to_connect(void);
-void publish_message(char datetime[], char topic[], char key[], char payload[]);
+bool wait_for_mqtt_to_connect(uint32_t timeout_ms);
+bool mqtt_is_connected(void);
+bool publish_message(char datetime[], char topic[], char key[], char payload[]);
+bool publish_fields(char datetime[], char topic[], const char* keys[], const char* values[], int count);
+bool publish_fields_confirmed(char datetime[], char topic[], const char* keys[], const char* values[], int count,
+                              uint32_t timeout_ms);
 void wait_for_all_messages_to_be_published(void);
 
 #endif
\ No newline at end of file
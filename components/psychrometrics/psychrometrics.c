@@ -0,0 +1,110 @@
+#include "psychrometrics.h"
+
+#include <stdint.h>
+#include <string.h>
+
+// Alduchov & Eskridge (1996) Magnus coefficients, over water
+#define MAGNUS_A 6.1094f
+#define MAGNUS_B 17.625f
+#define MAGNUS_C 243.04f
+
+#define KELVIN_OFFSET 273.15f
+// 1000 g/kg * 100 Pa/hPa / 461.5 J/(kg K), the specific gas constant of water vapour
+#define ABSOLUTE_HUMIDITY_FACTOR 216.68f
+// Ratio of the molar masses of water and dry air, in g/kg
+#define MIXING_RATIO_FACTOR 621.98f
+
+#define LOG2E 1.44269504f
+#define LN2 0.693147181f
+// ln(2) split so that n * LN2_HIGH is exact for any float exponent n
+#define LN2_HIGH 0.693145752f
+#define LN2_LOW 1.42860677e-6f
+#define SQRT2 1.41421356f
+
+static float bits_to_float(uint32_t bits) {
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+static uint32_t float_to_bits(float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+/**
+ * e^x as 2^n * e^f, with n an integer and |f| <= ln(2) / 2. f is taken off x with ln(2) in two parts, so it
+ * carries no rounding from n * ln(2). e^f is a degree 7 Taylor polynomial, within 6e-9 relative on that
+ * interval, and 2^n goes straight into the exponent bits. Within 2e-7 relative of exp over [-20, 20].
+ */
+float fast_expf(float x) {
+  if (x > 127.0f * LN2) {
+    x = 127.0f * LN2;
+  } else if (x < -126.0f * LN2) {
+    x = -126.0f * LN2;
+  }
+
+  float y = x * LOG2E;
+  int n = (int)(y < 0.0f ? y - 0.5f : y + 0.5f);
+  float f = (x - (float)n * LN2_HIGH) - (float)n * LN2_LOW;
+  float p = 1.0f / 24 + f * (1.0f / 120 + f * (1.0f / 720 + f * (1.0f / 5040)));
+  p = 1.0f + f * (1.0f + f * (0.5f + f * (1.0f / 6 + f * p)));
+  return p * bits_to_float((uint32_t)(n + 127) << 23);
+}
+
+/**
+ * ln(x) for x > 0, as n * ln(2) + ln(m) with m in [sqrt(1/2), sqrt(2)). ln(m) is the rational
+ * 2 * atanh((m - 1) / (m + 1)), whose series converges to within 3e-7 by the s^9 term on that interval.
+ * The low part of n * ln(2) is added to the series first so it isn't lost to rounding.
+ */
+float fast_logf(float x) {
+  uint32_t bits = float_to_bits(x);
+  int n = (int)((bits >> 23) & 0xFF) - 127;
+  float m = bits_to_float((bits & 0x007FFFFF) | 0x3F800000);
+  if (m > SQRT2) {
+    m *= 0.5f;
+    n++;
+  }
+
+  float s = (m - 1.0f) / (m + 1.0f);
+  float s2 = s * s;
+  float series = s * (2.0f + s2 * (2.0f / 3 + s2 * (2.0f / 5 + s2 * (2.0f / 7 + s2 * (2.0f / 9)))));
+  return (float)n * LN2_HIGH + (series + (float)n * LN2_LOW);
+}
+
+static float enhancement_factor(float pressure) { return 1.0016f + 3.15e-6f * pressure - 0.074f / pressure; }
+
+/**
+ * Saturation vapour pressure of water in moist air at the given pressure, in hPa
+ */
+float saturation_vapour_pressure(float temperature, float pressure) {
+  return enhancement_factor(pressure) * MAGNUS_A * fast_expf(MAGNUS_B * temperature / (MAGNUS_C + temperature));
+}
+
+/**
+ * Grams of water per cubic metre of air
+ */
+float absolute_humidity(float temperature, float relative_humidity, float pressure) {
+  float vapour_pressure = relative_humidity / 100.0f * saturation_vapour_pressure(temperature, pressure);
+  return ABSOLUTE_HUMIDITY_FACTOR * vapour_pressure / (temperature + KELVIN_OFFSET);
+}
+
+void compute_psychrometrics(float temperature, float relative_humidity, float pressure, struct Psychrometrics *result) {
+  // Below this the dew point is meaningless and the log would blow up
+  if (relative_humidity < 0.1f) {
+    relative_humidity = 0.1f;
+  }
+
+  float magnus_exponent = MAGNUS_B * temperature / (MAGNUS_C + temperature);
+  float saturation = enhancement_factor(pressure) * MAGNUS_A * fast_expf(magnus_exponent);
+  float vapour_pressure = relative_humidity / 100.0f * saturation;
+  float gamma = fast_logf(relative_humidity / 100.0f) + magnus_exponent;
+
+  result->saturation_vapour_pressure = saturation;
+  result->vapour_pressure = vapour_pressure;
+  result->dew_point = MAGNUS_C * gamma / (MAGNUS_B - gamma);
+  result->absolute_humidity = ABSOLUTE_HUMIDITY_FACTOR * vapour_pressure / (temperature + KELVIN_OFFSET);
+  result->vapour_pressure_deficit = (saturation - vapour_pressure) / 10.0f;
+  result->mixing_ratio = MIXING_RATIO_FACTOR * vapour_pressure / (pressure - vapour_pressure);
+}
@@ -0,0 +1,30 @@
+#ifndef psychrometrics_h
+#define psychrometrics_h
+
+/*
+ * Moist air properties derived from a BME280 sample, in single precision without expf/logf.
+ *
+ * Saturation vapour pressure uses the Magnus form with Alduchov & Eskridge (1996) coefficients over water,
+ * scaled by Buck's (1981) enhancement factor so the measured pressure is taken into account. fast_expf is
+ * within 2e-7 relative of exp over [-20, 20] and fast_logf within 5e-7 absolute of log over [1e-3, 1e3], so
+ * every result is within 1e-4 (in its own units) of the same formulas evaluated in double precision with libm
+ * for 0-50*C, 5-100 %RH and 800-1100 hPa. The Magnus fit itself is within 0.3% of Hardy's (1998) ITS-90
+ * saturation curve over 0-50*C. tools/host_tests/test_psychrometrics holds all of these.
+ */
+
+struct Psychrometrics {
+  float vapour_pressure;             // hPa
+  float saturation_vapour_pressure;  // hPa
+  float dew_point;                   // *C
+  float absolute_humidity;           // g/m^3
+  float vapour_pressure_deficit;     // kPa
+  float mixing_ratio;                // g/kg of dry air
+};
+
+float fast_expf(float x);
+float fast_logf(float x);
+float saturation_vapour_pressure(float temperature, float pressure);
+float absolute_humidity(float temperature, float relative_humidity, float pressure);
+void compute_psychrometrics(float temperature, float relative_humidity, float pressure, struct Psychrometrics* result);
+
+#endif
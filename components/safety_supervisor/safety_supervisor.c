@@ -0,0 +1,210 @@
+#include "safety_supervisor.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "actuator.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "heap_guard.h"
+#include "task_monitor.h"
+
+#define CHECK_PERIOD_MS CONFIG_SAFETY_CHECK_PERIOD_MS
+#define STALE_READING_US (CONFIG_SAFETY_STALE_READING_SECONDS * 1000000LL)
+#define MAXIMUM_TEMPERATURE (CONFIG_SAFETY_MAXIMUM_TEMPERATURE_DECIDEGREES / 10.0f)
+#define MAXIMUM_SENSOR_DISAGREEMENT (CONFIG_SAFETY_MAXIMUM_SENSOR_DISAGREEMENT_DECIDEGREES / 10.0f)
+#define TASK_PRIORITY CONFIG_SAFETY_TASK_PRIORITY
+#define TASK_CORE CONFIG_CONTROL_CORE
+#define TASK_STACK_SIZE 2048
+#define MAX_SENSORS 2
+
+// Sensors read this slowly at steady state, a single failed read would look like a sensor gone quiet
+#if CONFIG_READ_INTERVAL_SECONDS * 2 > CONFIG_SAFETY_STALE_READING_SECONDS
+#error "CONFIG_SAFETY_STALE_READING_SECONDS has to be at least twice CONFIG_READ_INTERVAL_SECONDS"
+#endif
+
+static const char *TAG = "safety";
+
+struct SensorReading {
+  int sensor_address;
+  float temperature;
+  int64_t received_at;
+};
+
+/* Everything below is shared between the control handlers (writers) and the
+ * supervisor task (reader), so it's only touched while holding the lock. */
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+static struct SensorReading readings[MAX_SENSORS];
+static int64_t started_at;
+static struct SafetyFault latched_fault;
+static bool fault_latched = false;
+static bool fault_reported = false;
+
+void safety_supervisor_record_temperature(int sensor_address, float temperature) {
+  int64_t now = esp_timer_get_time();
+
+  portENTER_CRITICAL(&lock);
+  for (int i = 0; i < MAX_SENSORS; i++) {
+    // Addresses are never 0, so an empty slot is free to claim
+    if (readings[i].sensor_address == sensor_address || readings[i].sensor_address == 0) {
+      readings[i].sensor_address = sensor_address;
+      readings[i].temperature = temperature;
+      readings[i].received_at = now;
+      break;
+    }
+  }
+  portEXIT_CRITICAL(&lock);
+}
+
+/* Returns the reason the heater must be forced off, if any. triggered_at is the moment
+ * the fault condition arose, which is what trip latency is measured against. */
+static enum SafetyFaultReason evaluate_interlocks(int64_t now, struct SafetyFault *fault, int64_t *triggered_at) {
+  for (int i = 0; i < MAX_SENSORS; i++) {
+    if (readings[i].sensor_address != 0 && now - readings[i].received_at <= STALE_READING_US &&
+        readings[i].temperature > MAXIMUM_TEMPERATURE) {
+      fault->temperature = readings[i].temperature;
+      fault->sensor_address = readings[i].sensor_address;
+      *triggered_at = readings[i].received_at;
+      return SAFETY_FAULT_OVER_TEMPERATURE;
+    }
+  }
+
+  // Any one sensor going quiet is a fault, a dead read task is exactly what this is here to catch. A sensor that
+  // has never reported counts from when the supervisor started.
+  int stalest = -1;
+  int64_t stalest_at = now;
+  for (int i = 0; i < MAX_SENSORS; i++) {
+    int64_t last_heard_at = readings[i].sensor_address != 0 ? readings[i].received_at : started_at;
+    if (now - last_heard_at > STALE_READING_US && last_heard_at < stalest_at) {
+      stalest = i;
+      stalest_at = last_heard_at;
+    }
+  }
+  if (stalest >= 0) {
+    fault->temperature = readings[stalest].sensor_address != 0 ? readings[stalest].temperature : NAN;
+    fault->sensor_address = readings[stalest].sensor_address;
+    *triggered_at = stalest_at + STALE_READING_US;
+    return SAFETY_FAULT_STALE_READINGS;
+  }
+
+  // Every sensor that has reported is fresh from here on, there's nothing to compare until both have
+  int newest = readings[0].received_at >= readings[1].received_at ? 0 : 1;
+  if (readings[0].sensor_address != 0 && readings[1].sensor_address != 0 &&
+      fabsf(readings[0].temperature - readings[1].temperature) > MAXIMUM_SENSOR_DISAGREEMENT) {
+    fault->temperature = readings[newest].temperature;
+    fault->sensor_address = readings[newest].sensor_address;
+    *triggered_at = readings[newest].received_at;
+    return SAFETY_FAULT_SENSOR_DISAGREEMENT;
+  }
+
+  return SAFETY_FAULT_NONE;
+}
+
+/**
+ * One pass over the interlocks. The supervisor task makes one every CHECK_PERIOD_MS, the host test calls it
+ * directly on a virtual clock.
+ */
+void safety_supervisor_check(void) {
+  if (fault_latched) {
+    // Keep asserting it, in case the controller raced the trip and switched the heater back on
+    actuator_force_off(ACTUATOR_HEATER);
+    return;
+  }
+
+  struct SafetyFault fault;
+  int64_t triggered_at;
+
+  portENTER_CRITICAL(&lock);
+  fault.reason = evaluate_interlocks(esp_timer_get_time(), &fault, &triggered_at);
+  portEXIT_CRITICAL(&lock);
+
+  if (fault.reason == SAFETY_FAULT_NONE) {
+    return;
+  }
+
+  actuator_force_off(ACTUATOR_HEATER);
+  fault.trip_latency_us = esp_timer_get_time() - triggered_at;
+
+  portENTER_CRITICAL(&lock);
+  latched_fault = fault;
+  fault_latched = true;
+  portEXIT_CRITICAL(&lock);
+
+  // In hundredths of a degree, this runs long after the heap guard's warm-up and the first float newlib formats
+  // on a task allocates. A sensor that never reported has no temperature, which logs as 0.00.
+  long centidegrees = isnan(fault.temperature) ? 0 : lroundf(fault.temperature * 100);
+  ESP_LOGE(TAG, "Interlock tripped (%s): %s%ld.%02ld*C from sensor %X, heater forced off %lld us after the fault arose",
+           safety_fault_reason_name(fault.reason), centidegrees < 0 ? "-" : "", labs(centidegrees) / 100,
+           labs(centidegrees) % 100, fault.sensor_address, fault.trip_latency_us);
+}
+
+static void safety_supervisor_task(void *arg) {
+  heap_guard_watch_current_task();
+
+  TickType_t last_wake_time = xTaskGetTickCount();
+  int64_t check_due_at = esp_timer_get_time();
+  while (true) {
+    vTaskDelayUntil(&last_wake_time, pdMS_TO_TICKS(CHECK_PERIOD_MS));
+    check_due_at += CHECK_PERIOD_MS * 1000LL;
+    task_monitor_record_latency(LATENCY_SAFETY, esp_timer_get_time() - check_due_at);
+    safety_supervisor_check();
+    heap_guard_end_cycle();
+  }
+}
+
+/**
+ * Runs independently of the event loop, so a dead sensor task or stalled handler still gets the heater turned off
+ */
+void start_safety_supervisor(void) {
+  ESP_LOGI(TAG, "Starting safety supervisor, limit %.1f*C, disagreement %.1f*C, stale after %d seconds",
+           MAXIMUM_TEMPERATURE, MAXIMUM_SENSOR_DISAGREEMENT, CONFIG_SAFETY_STALE_READING_SECONDS);
+  started_at = esp_timer_get_time();
+  static StaticTask_t task_buffer;
+  static StackType_t task_stack[TASK_STACK_SIZE];
+  xTaskCreateStaticPinnedToCore(&safety_supervisor_task, "safety_supervisor", TASK_STACK_SIZE, NULL, TASK_PRIORITY,
+                                task_stack, &task_buffer, TASK_CORE);
+}
+
+bool safety_fault_latched(void) {
+  portENTER_CRITICAL(&lock);
+  bool latched = fault_latched;
+  portEXIT_CRITICAL(&lock);
+  return latched;
+}
+
+/**
+ * Hands out the latched fault until safety_acknowledge_fault_reported() says it has gone out, so a report that
+ * gets dropped on the way is made again rather than lost
+ */
+bool safety_peek_unreported_fault(struct SafetyFault *fault) {
+  bool unreported = false;
+  portENTER_CRITICAL(&lock);
+  if (fault_latched && !fault_reported) {
+    *fault = latched_fault;
+    unreported = true;
+  }
+  portEXIT_CRITICAL(&lock);
+  return unreported;
+}
+
+void safety_acknowledge_fault_reported(void) {
+  portENTER_CRITICAL(&lock);
+  // A fault stays latched until reboot, so the one acknowledged is the one peeked
+  fault_reported = fault_latched;
+  portEXIT_CRITICAL(&lock);
+}
+
+const char *safety_fault_reason_name(enum SafetyFaultReason reason) {
+  switch (reason) {
+    case SAFETY_FAULT_OVER_TEMPERATURE:
+      return "over_temperature";
+    case SAFETY_FAULT_SENSOR_DISAGREEMENT:
+      return "sensor_disagreement";
+    case SAFETY_FAULT_STALE_READINGS:
+      return "stale_readings";
+    default:
+      return "none";
+  }
+}
@@ -0,0 +1,32 @@
+#ifndef safety_supervisor_h
+#define safety_supervisor_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+enum SafetyFaultReason {
+  SAFETY_FAULT_NONE,
+  SAFETY_FAULT_OVER_TEMPERATURE,
+  SAFETY_FAULT_SENSOR_DISAGREEMENT,
+  SAFETY_FAULT_STALE_READINGS
+};
+
+struct SafetyFault {
+  enum SafetyFaultReason reason;
+  // The reading that tripped the interlock (the quiet sensor's last one for stale readings, 0 and NAN if it
+  // never reported)
+  float temperature;
+  int sensor_address;
+  // Time from the fault condition arising to the heater being forced off
+  int64_t trip_latency_us;
+};
+
+void start_safety_supervisor(void);
+void safety_supervisor_check(void);
+void safety_supervisor_record_temperature(int sensor_address, float temperature);
+bool safety_fault_latched(void);
+bool safety_peek_unreported_fault(struct SafetyFault* fault);
+void safety_acknowledge_fault_reported(void);
+const char* safety_fault_reason_name(enum SafetyFaultReason reason);
+
+#endif
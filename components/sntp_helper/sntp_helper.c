@@ -1,36 +1,154 @@
 #include "sntp_helper.h"
 
+#include <math.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <sys/time.h>
+#include <time.h>
 
 #include "esp_log.h"
 #include "esp_sntp.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 
 #define SNTP_HOST CONFIG_SNTP_HOST
+#define SNTP_TIMEZONE CONFIG_SNTP_TIMEZONE
 #define NTP_SYNC_PERIOD_SECONDS CONFIG_NTP_SYNC_PERIOD_SECONDS
+#define HOLDOVER_INTERVAL_SECONDS CONFIG_SNTP_HOLDOVER_INTERVAL_SECONDS
+#define ERROR_BUDGET_MS CONFIG_SNTP_ERROR_BUDGET_MS
+
+// Offsets bigger than this are stepped, newlib's adjtime refuses anything much over half an hour anyway
+#define STEP_THRESHOLD_US (60 * 1000000LL)
+// Syncs closer together than this are too short to say anything useful about drift
+#define MINIMUM_DRIFT_INTERVAL_US (10 * 60 * 1000000LL)
+// How far any single drift estimate is trusted, the 32 kHz crystal is nowhere near this bad
+#define MAXIMUM_DRIFT_PPM 500.0f
+// Weight of each new measurement in the drift estimate
+#define DRIFT_GAIN 0.5f
+// What a single SNTP exchange over the local network is assumed to be good to
+#define SYNC_ERROR_US 50000LL
+// Floor on how well the drift is known, even after it has settled
+#define DRIFT_UNCERTAINTY_PPM 2.0f
 
 static const char* TAG = "sntp_helper";
+
+/* Kept in RTC memory, so the clock discipline carries on across deep sleep and resets. The RTC keeps the
+ * system time itself running through both, these let it keep being corrected. */
 RTC_DATA_ATTR static time_t last_sntp_sync;
+RTC_DATA_ATTR static int64_t last_sync_us;
+RTC_DATA_ATTR static int64_t last_offset_us;
+RTC_DATA_ATTR static float drift_ppm;
+RTC_DATA_ATTR static float last_residual_ppm;
+RTC_DATA_ATTR static uint32_t sync_count;
+// System time holdover corrections have been applied up to
+RTC_DATA_ATTR static int64_t holdover_applied_us;
+
+// Shared between the LwIP task (syncs), the holdover timer and telemetry
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+/* Serialises corrections to the clock itself between the LwIP task and the holdover timer. A mutex rather than
+ * the spinlock above, newlib's adjtime takes a lock of its own and can't be called from a critical section. */
+static SemaphoreHandle_t clock_lock;
+static StaticSemaphore_t clock_lock_buffer;
+
+static int64_t to_us(const struct timeval* tv) { return (int64_t)tv->tv_sec * 1000000LL + tv->tv_usec; }
+
+static struct timeval from_us(int64_t us) {
+  struct timeval tv = {.tv_sec = us / 1000000LL, .tv_usec = us % 1000000LL};
+  return tv;
+}
 
-void obtain_time(time_t* current_time) {
-  initialize_sntp();
+static int64_t system_time_us(void) {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return to_us(&now);
+}
 
-  int retry = 0;
-  const int retry_count = 10;
-  while (sntp_get_sync_status() == SNTP_SYNC_STATUS_RESET && ++retry < retry_count) {
-    ESP_LOGI(TAG, "Waiting for system time to be set... (%d/%d)", retry, retry_count);
-    vTaskDelay(5000 / portTICK_PERIOD_MS);
-  }
+/**
+ * Slews the clock by delta on top of whatever correction is still being worked off, rather than replacing it.
+ * Caller holds clock_lock.
+ */
+static void slew_by(int64_t delta_us) {
+  struct timeval outstanding;
+  adjtime(NULL, &outstanding);
+  struct timeval total = from_us(to_us(&outstanding) + delta_us);
+  adjtime(&total, NULL);
+}
 
-  if (retry == retry_count) {
-    ESP_LOGE(TAG, "Failed to sync with NTP server, not updating time");
+/**
+ * Called by LwIP with the server's time, in place of ESP-IDF's default. The offset is measured before anything
+ * is corrected, which the default (and its notification callback) doesn't allow for.
+ */
+void sntp_sync_time(struct timeval* tv) {
+  xSemaphoreTake(clock_lock, portMAX_DELAY);
+  int64_t server_us = to_us(tv);
+  int64_t offset_us = server_us - system_time_us();
+  bool stepped = llabs(offset_us) > STEP_THRESHOLD_US || !time_is_set(tv->tv_sec - offset_us / 1000000LL);
+
+  if (stepped) {
+    settimeofday(tv, NULL);
   } else {
-    time(current_time);
-    time(&last_sntp_sync);
+    /* The offset is measured against the clock as it stands, so whatever is still outstanding from earlier
+     * corrections is already part of it. Replace the outstanding correction, adding to it would count it twice. */
+    struct timeval correction = from_us(offset_us);
+    adjtime(&correction, NULL);
+  }
+  xSemaphoreGive(clock_lock);
+
+  portENTER_CRITICAL(&lock);
+  int64_t interval_us = server_us - last_sync_us;
+  // A step means the clock wasn't being kept, so there's no drift to learn from it
+  if (!stepped && sync_count > 0 && interval_us > MINIMUM_DRIFT_INTERVAL_US) {
+    // What's left after holdover corrections is how wrong the current estimate is
+    float residual_ppm = (float)offset_us * 1e6f / (float)interval_us;
+    if (residual_ppm > -MAXIMUM_DRIFT_PPM && residual_ppm < MAXIMUM_DRIFT_PPM) {
+      drift_ppm += DRIFT_GAIN * residual_ppm;
+      last_residual_ppm = residual_ppm;
+    }
+  }
+  last_offset_us = offset_us;
+  last_sync_us = server_us;
+  holdover_applied_us = server_us;
+  last_sntp_sync = tv->tv_sec;
+  sync_count++;
+  portEXIT_CRITICAL(&lock);
+
+  sntp_set_sync_status(SNTP_SYNC_STATUS_COMPLETED);
+  ESP_LOGI(TAG, "Time has been synchronized with NTP, offset was %lld ms (%s), drift estimate %.2f ppm",
+           offset_us / 1000, stepped ? "stepped" : "slewing", drift_ppm);
+}
+
+/**
+ * Between syncs, slews out the drift the crystal is expected to have built up, so time stays within budget
+ * through network outages
+ */
+static void holdover_callback(void* arg) {
+  int64_t now_us = system_time_us();
+
+  portENTER_CRITICAL(&lock);
+  int64_t elapsed_us = now_us - holdover_applied_us;
+  int64_t correction_us = sync_count > 0 ? (int64_t)(drift_ppm * (float)elapsed_us / 1e6f) : 0;
+  holdover_applied_us = now_us;
+  portEXIT_CRITICAL(&lock);
+
+  if (correction_us != 0) {
+    xSemaphoreTake(clock_lock, portMAX_DELAY);
+    slew_by(correction_us);
+    xSemaphoreGive(clock_lock);
+  }
+
+  struct TimeSyncStatus status;
+  get_time_sync_status(&status);
+  if (status.synchronized && status.error_bound_ms > ERROR_BUDGET_MS) {
+    ESP_LOGW(TAG, "Estimated time error %u ms is over the %d ms budget, %u seconds since last sync",
+             status.error_bound_ms, ERROR_BUDGET_MS, status.seconds_since_sync);
   }
 }
 
-void initialize_sntp(void) {
+/**
+ * Starts syncing in the background. Never blocks, time is corrected whenever the network allows.
+ */
+void start_sntp(void) {
   int sntp_sync_status = sntp_get_sync_status();
   if (sntp_sync_status == SNTP_SYNC_STATUS_RESET) {
     ESP_LOGI(TAG, "    SNTP_SYNC_STATUS_RESET");
@@ -39,18 +157,39 @@ void initialize_sntp(void) {
   } else if (sntp_sync_status == SNTP_SYNC_STATUS_IN_PROGRESS) {
     ESP_LOGI(TAG, "    SNTP_SYNC_STATUS_IN_PROGRESS");
   }
-  ESP_LOGI(TAG, "Initializing SNTP");
+  ESP_LOGI(TAG, "Initializing SNTP, resyncing every %d seconds", NTP_SYNC_PERIOD_SECONDS);
   sntp_setoperatingmode(SNTP_OPMODE_POLL);
   sntp_setservername(0, SNTP_HOST);
-  sntp_set_time_sync_notification_cb(time_sync_notification_cb);
+  sntp_set_sync_interval(NTP_SYNC_PERIOD_SECONDS * 1000UL);
+  clock_lock = xSemaphoreCreateMutexStatic(&clock_lock_buffer);
   sntp_init();
+
+  const esp_timer_create_args_t holdover_timer_args = {.callback = &holdover_callback, .name = "sntp_holdover"};
+  esp_timer_handle_t holdover_timer;
+  ESP_ERROR_CHECK(esp_timer_create(&holdover_timer_args, &holdover_timer));
+  ESP_ERROR_CHECK(esp_timer_start_periodic(holdover_timer, HOLDOVER_INTERVAL_SECONDS * 1000000ULL));
 }
 
-void time_sync_notification_cb(struct timeval* tv) { ESP_LOGI(TAG, "Time has been synchronized with NTP!"); }
+void get_time_sync_status(struct TimeSyncStatus* status) {
+  int64_t now_us = system_time_us();
+
+  portENTER_CRITICAL(&lock);
+  status->synchronized = sync_count > 0;
+  status->sync_count = sync_count;
+  status->last_offset_us = last_offset_us;
+  status->drift_ppm = drift_ppm;
+  int64_t since_sync_us = sync_count > 0 ? now_us - last_sync_us : 0;
+  // The last correction to the drift estimate is the best guess at how far off it still is
+  float drift_uncertainty_ppm = fmaxf(fabsf(last_residual_ppm), DRIFT_UNCERTAINTY_PPM);
+  portEXIT_CRITICAL(&lock);
+
+  status->seconds_since_sync = (uint32_t)(since_sync_us / 1000000LL);
+  status->error_bound_ms =
+      (uint32_t)((SYNC_ERROR_US + (int64_t)(drift_uncertainty_ppm * (float)since_sync_us / 1e6f)) / 1000);
+}
 
 void set_current_time(time_t* now) {
-  // Set timezone to Eastern Standard Time
-  setenv("TZ", "EST5EDT,M3.2.0/2,M11.1.0", 1);
+  setenv("TZ", SNTP_TIMEZONE, 1);
   tzset();
   time(now);
 }
@@ -95,4 +234,4 @@ void get_time_string(char timestring[]) {
   localtime_r(&now, &timeinfo);
   // Add 5 for the timezone in format '+hhmm'
   strftime(timestring, 64 * sizeof(timestring[0]) + 5, "%c %z", &timeinfo);
-}
\ No newline at end of file
+}
@@ -2,11 +2,23 @@
 #define sntp_helper_h
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/time.h>
 
-void obtain_time(time_t* now);
-void initialize_sntp(void);
-void time_sync_notification_cb(struct timeval* tv);
+struct TimeSyncStatus {
+  bool synchronized;
+  uint32_t sync_count;
+  // Server minus local time at the last sync, before it was corrected
+  int64_t last_offset_us;
+  // How fast the local clock runs, positive is slow. Corrected for between syncs.
+  float drift_ppm;
+  uint32_t seconds_since_sync;
+  // Worst case the clock is expected to be off by right now
+  uint32_t error_bound_ms;
+};
+
+void start_sntp(void);
+void get_time_sync_status(struct TimeSyncStatus* status);
 void set_current_time(time_t* now);
 bool time_is_set(time_t now);
 bool time_is_stale(time_t now);
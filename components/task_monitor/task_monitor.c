@@ -0,0 +1,121 @@
+#include "task_monitor.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#ifdef CONFIG_TASK_MONITOR_CPU_USAGE
+// Comfortably more than the firmware and ESP-IDF start between them
+#define MAX_TASKS 32
+#endif
+
+static const char *TAG = "task_monitor";
+
+// Latencies are recorded from the control, safety and turner tasks and taken by telemetry
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t worst_latency_us[LATENCY_SOURCE_COUNT];
+
+void task_monitor_record_latency(enum LatencySource source, int64_t latency_us) {
+  uint32_t clamped_us = latency_us < 0 ? 0 : latency_us > UINT32_MAX ? UINT32_MAX : (uint32_t)latency_us;
+
+  portENTER_CRITICAL(&lock);
+  if (clamped_us > worst_latency_us[source]) {
+    worst_latency_us[source] = clamped_us;
+  }
+  portEXIT_CRITICAL(&lock);
+}
+
+#ifdef CONFIG_TASK_MONITOR_CPU_USAGE
+/* Run time counters only ever go up, so usage over an interval is the difference from the last report. Only
+ * telemetry takes reports, and these are static so it doesn't need the heap or a big stack to do it. */
+struct PreviousRunTime {
+  TaskHandle_t task;
+  uint32_t run_time;
+};
+
+static TaskStatus_t tasks[MAX_TASKS];
+static struct PreviousRunTime previous[MAX_TASKS];
+static int previous_count;
+static uint32_t previous_total_run_time;
+
+static uint32_t previous_run_time(TaskHandle_t task) {
+  for (int i = 0; i < previous_count; i++) {
+    if (previous[i].task == task) {
+      return previous[i].run_time;
+    }
+  }
+  // Started since the last report
+  return 0;
+}
+
+static void measure_cpu_usage(struct TaskMonitorReport *report) {
+  uint32_t total_run_time;
+  UBaseType_t count = uxTaskGetSystemState(tasks, MAX_TASKS, &total_run_time);
+  if (count == 0) {
+    ESP_LOGW(TAG, "More than %d tasks, not measuring CPU usage", MAX_TASKS);
+    return;
+  }
+  // Each core's run time goes up at the rate of the counter, so a task's share is of one core
+  uint32_t elapsed = total_run_time - previous_total_run_time;
+
+  report->cpu_usage_available = previous_count > 0 && elapsed > 0;
+  report->busiest_task_percent = 0;
+  for (int core = 0; core < TASK_MONITOR_CORES; core++) {
+    report->core_load_percent[core] = 0;
+  }
+
+  for (UBaseType_t i = 0; i < count && report->cpu_usage_available; i++) {
+    uint32_t used = tasks[i].ulRunTimeCounter - previous_run_time(tasks[i].xHandle);
+    uint8_t percent = (uint8_t)((uint64_t)used * 100 / elapsed);
+    BaseType_t affinity = xTaskGetAffinity(tasks[i].xHandle);
+    ESP_LOGD(TAG, "%-16s core %-2d priority %2u %3u%%", tasks[i].pcTaskName, affinity == tskNO_AFFINITY ? -1 : affinity,
+             tasks[i].uxCurrentPriority, percent);
+
+    bool idle = false;
+    for (int core = 0; core < TASK_MONITOR_CORES; core++) {
+      if (tasks[i].xHandle == xTaskGetIdleTaskHandleForCPU(core)) {
+        // Whatever the idle task didn't get, something else did
+        report->core_load_percent[core] = percent < 100 ? 100 - percent : 0;
+        idle = true;
+      }
+    }
+    if (!idle && percent > report->busiest_task_percent) {
+      report->busiest_task_percent = percent;
+      snprintf(report->busiest_task, sizeof(report->busiest_task), "%s", tasks[i].pcTaskName);
+    }
+  }
+
+  for (UBaseType_t i = 0; i < count; i++) {
+    previous[i] = (struct PreviousRunTime){.task = tasks[i].xHandle, .run_time = tasks[i].ulRunTimeCounter};
+  }
+  previous_count = count;
+  previous_total_run_time = total_run_time;
+}
+#endif
+
+/**
+ * Fills in the report and starts the next interval. The first report after boot has no CPU usage, there's
+ * nothing to measure it against yet.
+ */
+void task_monitor_take_report(struct TaskMonitorReport *report) {
+  memset(report, 0, sizeof(*report));
+#ifdef CONFIG_TASK_MONITOR_CPU_USAGE
+  measure_cpu_usage(report);
+#endif
+
+  portENTER_CRITICAL(&lock);
+  memcpy(report->worst_latency_us, worst_latency_us, sizeof(worst_latency_us));
+  memset(worst_latency_us, 0, sizeof(worst_latency_us));
+  portEXIT_CRITICAL(&lock);
+
+  if (report->cpu_usage_available) {
+    ESP_LOGI(TAG, "Core load %u%% / %u%%, busiest task %s at %u%%, worst control latency %u us",
+             report->core_load_percent[0], report->core_load_percent[1], report->busiest_task,
+             report->busiest_task_percent, report->worst_latency_us[LATENCY_CONTROL]);
+  } else {
+    ESP_LOGI(TAG, "Worst control latency %u us", report->worst_latency_us[LATENCY_CONTROL]);
+  }
+}
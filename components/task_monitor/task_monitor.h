@@ -0,0 +1,36 @@
+#ifndef task_monitor_h
+#define task_monitor_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Checks the task layout is doing its job, with the worst latency seen on each path that ends in actuation and,
+ * with CONFIG_TASK_MONITOR_CPU_USAGE, how busy each core is.
+ */
+
+enum LatencySource {
+  // From a reading being taken to the controller having acted on it
+  LATENCY_CONTROL,
+  // How late the safety supervisor's periodic check ran
+  LATENCY_SAFETY,
+  // From the turning timer firing to the turner starting to rotate
+  LATENCY_TURNER,
+  LATENCY_SOURCE_COUNT
+};
+
+#define TASK_MONITOR_CORES 2
+
+struct TaskMonitorReport {
+  bool cpu_usage_available;
+  // Since the previous report
+  uint8_t core_load_percent[TASK_MONITOR_CORES];
+  char busiest_task[16];
+  uint8_t busiest_task_percent;
+  uint32_t worst_latency_us[LATENCY_SOURCE_COUNT];
+};
+
+void task_monitor_record_latency(enum LatencySource source, int64_t latency_us);
+void task_monitor_take_report(struct TaskMonitorReport* report);
+
+#endif
@@ -0,0 +1,203 @@
+#include "telemetry.h"
+
+#include <stdio.h>
+
+#include "actuator.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "heap_guard.h"
+#include "mqtt_helper.h"
+#include "safety_supervisor.h"
+#include "sntp_helper.h"
+#include "task_monitor.h"
+#include "wifi_helper.h"
+
+#define TELEMETRY_INTERVAL_SECONDS CONFIG_TELEMETRY_INTERVAL_SECONDS
+// A latched safety fault is looked for this often, it shouldn't wait for the next full report
+#define FAULT_POLL_MS 1000
+// How long the publisher task gets to hand the fault report to the client before it's tried again
+#define FAULT_PUBLISH_TIMEOUT_MS 500
+#define TASK_PRIORITY 3
+#define TASK_CORE CONFIG_NETWORK_CORE
+#define TASK_STACK_SIZE 3072
+
+static const char *TAG = "telemetry";
+
+/**
+ * Reported from here rather than the control path, since a stalled control loop or dead sensor is what trips it
+ */
+static void publish_safety_fault(void) {
+  struct SafetyFault fault;
+  // Held until it has actually gone out, publishing while disconnected would drop it
+  if (!mqtt_is_connected() || !safety_peek_unreported_fault(&fault)) {
+    return;
+  }
+
+  char strftime_buf[64];
+  get_time_string(strftime_buf);
+
+  char temperature[8];
+  char sensor_address[5];
+  char trip_latency_ms[12];
+  snprintf(temperature, sizeof(temperature), "%.2f", fault.temperature);
+  snprintf(sensor_address, sizeof(sensor_address), "%X", fault.sensor_address);
+  snprintf(trip_latency_ms, sizeof(trip_latency_ms), "%lld", fault.trip_latency_us / 1000);
+
+  const char *keys[] = {"fault", "temperature", "sensor_address", "trip_latency_ms"};
+  const char *values[] = {safety_fault_reason_name(fault.reason), temperature, sensor_address, trip_latency_ms};
+  if (publish_fields_confirmed(strftime_buf, "incubator/fault", keys, values, 4, FAULT_PUBLISH_TIMEOUT_MS)) {
+    safety_acknowledge_fault_reported();
+  } else {
+    ESP_LOGW(TAG, "Safety fault report didn't go out, trying again in %d ms", FAULT_POLL_MS);
+  }
+}
+
+static void publish_actuator_telemetry(char strftime_buf[]) {
+  for (int id = 0; id < ACTUATOR_COUNT; id++) {
+    struct ActuatorStats stats;
+    actuator_get_stats(id, &stats);
+
+    char on_time_seconds[16];
+    char switch_count[12];
+    snprintf(on_time_seconds, sizeof(on_time_seconds), "%lld", stats.on_time_us / 1000000LL);
+    snprintf(switch_count, sizeof(switch_count), "%u", stats.switch_count);
+
+    const char *keys[] = {"actuator", "state", "on_time_seconds", "switch_count"};
+    const char *values[] = {actuator_name(id), stats.on ? "on" : "off", on_time_seconds, switch_count};
+    publish_fields(strftime_buf, "incubator/actuator", keys, values, 4);
+  }
+}
+
+static void publish_network_telemetry(char strftime_buf[]) {
+  struct WifiStatus status;
+  wifi_get_status(&status);
+
+  char rssi[8];
+  char connected_seconds[12];
+  char disconnect_count[12];
+  char last_disconnect_reason[8];
+  char reconnect_latency_ms[12];
+  char max_reconnect_latency_ms[12];
+  snprintf(rssi, sizeof(rssi), "%d", status.rssi);
+  snprintf(connected_seconds, sizeof(connected_seconds), "%u", status.connected_seconds);
+  snprintf(disconnect_count, sizeof(disconnect_count), "%u", status.disconnect_count);
+  snprintf(last_disconnect_reason, sizeof(last_disconnect_reason), "%d", status.last_disconnect_reason);
+  snprintf(reconnect_latency_ms, sizeof(reconnect_latency_ms), "%u", status.reconnect_latency_ms);
+  snprintf(max_reconnect_latency_ms, sizeof(max_reconnect_latency_ms), "%u", status.max_reconnect_latency_ms);
+
+  const char *keys[] = {"state", "rssi", "connected_seconds", "disconnect_count", "last_disconnect_reason",
+                        "reconnect_latency_ms", "max_reconnect_latency_ms"};
+  const char *values[] = {wifi_state_name(status.state), rssi, connected_seconds, disconnect_count,
+                          last_disconnect_reason, reconnect_latency_ms, max_reconnect_latency_ms};
+  publish_fields(strftime_buf, "incubator/network", keys, values, 7);
+}
+
+static void publish_time_telemetry(char strftime_buf[]) {
+  struct TimeSyncStatus status;
+  get_time_sync_status(&status);
+
+  char offset_ms[24];
+  char drift_ppm[16];
+  char seconds_since_sync[12];
+  char error_bound_ms[12];
+  char sync_count[12];
+  snprintf(offset_ms, sizeof(offset_ms), "%.3f", status.last_offset_us / 1000.0);
+  snprintf(drift_ppm, sizeof(drift_ppm), "%.2f", status.drift_ppm);
+  snprintf(seconds_since_sync, sizeof(seconds_since_sync), "%u", status.seconds_since_sync);
+  snprintf(error_bound_ms, sizeof(error_bound_ms), "%u", status.error_bound_ms);
+  snprintf(sync_count, sizeof(sync_count), "%u", status.sync_count);
+
+  const char *keys[] = {"synchronized", "offset_ms", "drift_ppm", "seconds_since_sync", "error_bound_ms",
+                        "sync_count"};
+  const char *values[] = {status.synchronized ? "true" : "false", offset_ms, drift_ppm, seconds_since_sync,
+                          error_bound_ms, sync_count};
+  publish_fields(strftime_buf, "incubator/time", keys, values, 6);
+}
+
+/**
+ * Free heap and the largest block left, so fragmentation shows up over a long run before an allocation fails
+ */
+static void publish_heap_telemetry(char strftime_buf[]) {
+  char free_bytes[12];
+  char minimum_free_bytes[12];
+  char largest_free_block[12];
+  char steady_state_allocations[12];
+  snprintf(free_bytes, sizeof(free_bytes), "%u", heap_caps_get_free_size(MALLOC_CAP_8BIT));
+  snprintf(minimum_free_bytes, sizeof(minimum_free_bytes), "%u", heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT));
+  snprintf(largest_free_block, sizeof(largest_free_block), "%u", heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+  snprintf(steady_state_allocations, sizeof(steady_state_allocations), "%u", heap_guard_steady_state_allocations());
+
+  const char *keys[] = {"free_bytes", "minimum_free_bytes", "largest_free_block", "steady_state_allocations"};
+  const char *values[] = {free_bytes, minimum_free_bytes, largest_free_block, steady_state_allocations};
+  publish_fields(strftime_buf, "incubator/heap", keys, values, 4);
+}
+
+/**
+ * Whether the task layout is keeping the network off the control core, and the worst each actuation path has
+ * been held up since the last report
+ */
+static void publish_task_telemetry(char strftime_buf[]) {
+  struct TaskMonitorReport report;
+  task_monitor_take_report(&report);
+
+  char latencies[LATENCY_SOURCE_COUNT][12];
+  const char *keys[LATENCY_SOURCE_COUNT + 4];
+  const char *values[LATENCY_SOURCE_COUNT + 4];
+  int count = 0;
+
+  // In LatencySource order
+  static const char *latency_keys[LATENCY_SOURCE_COUNT] = {"control_latency_us", "safety_latency_us",
+                                                           "turner_latency_us"};
+  for (int source = 0; source < LATENCY_SOURCE_COUNT; source++) {
+    snprintf(latencies[source], sizeof(latencies[source]), "%u", report.worst_latency_us[source]);
+    keys[count] = latency_keys[source];
+    values[count++] = latencies[source];
+  }
+
+  char core_load[TASK_MONITOR_CORES][4];
+  char busiest_task_percent[4];
+  if (report.cpu_usage_available) {
+    static const char *core_keys[] = {"core0_load_percent", "core1_load_percent"};
+    for (int core = 0; core < TASK_MONITOR_CORES; core++) {
+      snprintf(core_load[core], sizeof(core_load[core]), "%u", report.core_load_percent[core]);
+      keys[count] = core_keys[core];
+      values[count++] = core_load[core];
+    }
+    snprintf(busiest_task_percent, sizeof(busiest_task_percent), "%u", report.busiest_task_percent);
+    keys[count] = "busiest_task";
+    values[count++] = report.busiest_task;
+    keys[count] = "busiest_task_percent";
+    values[count++] = busiest_task_percent;
+  }
+  publish_fields(strftime_buf, "incubator/tasks", keys, values, count);
+}
+
+static void telemetry_task(void *arg) {
+  TickType_t last_report = xTaskGetTickCount();
+  while (true) {
+    vTaskDelay(pdMS_TO_TICKS(FAULT_POLL_MS));
+    publish_safety_fault();
+    if (xTaskGetTickCount() - last_report < pdMS_TO_TICKS(TELEMETRY_INTERVAL_SECONDS * 1000)) {
+      continue;
+    }
+    last_report = xTaskGetTickCount();
+
+    char strftime_buf[64];
+    get_time_string(strftime_buf);
+    publish_actuator_telemetry(strftime_buf);
+    publish_network_telemetry(strftime_buf);
+    publish_time_telemetry(strftime_buf);
+    publish_heap_telemetry(strftime_buf);
+    publish_task_telemetry(strftime_buf);
+  }
+}
+
+void start_telemetry(void) {
+  ESP_LOGI(TAG, "Publishing telemetry every %d seconds", TELEMETRY_INTERVAL_SECONDS);
+  static StaticTask_t task_buffer;
+  static StackType_t task_stack[TASK_STACK_SIZE];
+  xTaskCreateStaticPinnedToCore(&telemetry_task, "telemetry", TASK_STACK_SIZE, NULL, TASK_PRIORITY, task_stack,
+                                &task_buffer, TASK_CORE);
+}
@@ -0,0 +1,6 @@
+#ifndef telemetry_h
+#define telemetry_h
+
+void start_telemetry(void);
+
+#endif
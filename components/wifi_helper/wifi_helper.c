@@ -1,9 +1,11 @@
+#include "wifi_helper.h"
+
 #include <string.h>
 
 #include "esp_event.h"
 #include "esp_log.h"
-#include "esp_sleep.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "esp_wifi.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
@@ -13,7 +15,8 @@
 
 #define WIFI_SSID CONFIG_WIFI_SSID
 #define WIFI_PASSWORD CONFIG_WIFI_PASSWORD
-#define MAXIMUM_RETRY CONFIG_WIFI_MAXIMUM_RETRY
+#define BACKOFF_INITIAL_MS CONFIG_WIFI_BACKOFF_INITIAL_MS
+#define BACKOFF_MAXIMUM_MS CONFIG_WIFI_BACKOFF_MAXIMUM_MS
 
 /* The event group allows multiple bits for each event, but we only care about one event
  * - are we connected to the AP with an IP? */
@@ -21,39 +24,109 @@ const int WIFI_CONNECTED_BIT = BIT0;
 
 static const char* TAG = "WiFi helper";
 
-static int s_retry_num = 0;
-
 /* FreeRTOS event group to signal when we are connected*/
 static EventGroupHandle_t wifi_event_group;
 
-RTC_DATA_ATTR static useconds_t connection_delay = 500000;  // 1/2 second Delay in usec
+// Fires the next connection attempt once the backoff has passed, so nothing ever waits on Wi-Fi
+static esp_timer_handle_t reconnect_timer;
+
+/* Written from the event loop and the reconnect timer, read by telemetry */
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+static struct WifiStatus status = {.state = WIFI_STATE_STARTING};
+static int64_t disconnected_at;
+static int64_t connected_at;
+
+static uint32_t backoff_delay_ms(uint32_t consecutive_failures) {
+  uint32_t delay_ms = BACKOFF_INITIAL_MS;
+  for (uint32_t i = 0; i < consecutive_failures && delay_ms < BACKOFF_MAXIMUM_MS; i++) {
+    delay_ms *= 2;
+  }
+  if (delay_ms > BACKOFF_MAXIMUM_MS) {
+    delay_ms = BACKOFF_MAXIMUM_MS;
+  }
+  // Anywhere in the upper half, so a barn full of incubators doesn't hammer the AP in lockstep after it reboots
+  return delay_ms / 2 + esp_random() % (delay_ms / 2 + 1);
+}
+
+static void set_state(enum WifiState state) {
+  portENTER_CRITICAL(&lock);
+  status.state = state;
+  portEXIT_CRITICAL(&lock);
+}
+
+static void reconnect_timer_callback(void* arg) {
+  set_state(WIFI_STATE_CONNECTING);
+  esp_wifi_connect();
+}
+
+static void handle_disconnect(wifi_event_sta_disconnected_t* event) {
+  int64_t now = esp_timer_get_time();
+  xEventGroupClearBits(wifi_event_group, WIFI_CONNECTED_BIT);
+
+  portENTER_CRITICAL(&lock);
+  if (status.state == WIFI_STATE_CONNECTED) {
+    disconnected_at = now;
+    status.disconnect_count++;
+  }
+  status.last_disconnect_reason = event->reason;
+  uint32_t consecutive_failures = status.consecutive_failures++;
+  status.state = WIFI_STATE_BACKOFF;
+  portEXIT_CRITICAL(&lock);
+
+  uint32_t delay_ms = backoff_delay_ms(consecutive_failures);
+  ESP_LOGI(TAG, "Disconnected from the AP (reason %d), retrying in %u ms", event->reason, delay_ms);
+  esp_timer_stop(reconnect_timer);
+  esp_timer_start_once(reconnect_timer, delay_ms * 1000ULL);
+}
+
+static void handle_got_ip(ip_event_got_ip_t* event) {
+  int64_t now = esp_timer_get_time();
+  wifi_ap_record_t ap_info;
+  bool have_ap_info = esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK;
+
+  portENTER_CRITICAL(&lock);
+  uint32_t reconnect_latency_ms = (uint32_t)((now - disconnected_at) / 1000);
+  status.reconnect_latency_ms = reconnect_latency_ms;
+  if (reconnect_latency_ms > status.max_reconnect_latency_ms) {
+    status.max_reconnect_latency_ms = reconnect_latency_ms;
+  }
+  status.consecutive_failures = 0;
+  if (have_ap_info) {
+    status.rssi = ap_info.rssi;
+  }
+  status.state = WIFI_STATE_CONNECTED;
+  connected_at = now;
+  portEXIT_CRITICAL(&lock);
+
+  ESP_LOGI(TAG, "Obtained IP address: %s, %u ms after losing the connection", ip4addr_ntoa(&event->ip_info.ip),
+           reconnect_latency_ms);
+  xEventGroupSetBits(wifi_event_group, WIFI_CONNECTED_BIT);
+}
 
 static void event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data) {
   // When starting Wi-Fi has gone well and the intention is to connect in station mode
   if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
+    set_state(WIFI_STATE_CONNECTING);
     esp_wifi_connect();
     // If the Wi-Fi connection is disconnected unexpectedly (or fails to set up a connection in some cases)
   } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
-    if (s_retry_num < MAXIMUM_RETRY) {
-      esp_wifi_connect();
-      xEventGroupClearBits(wifi_event_group, WIFI_CONNECTED_BIT);
-      s_retry_num++;
-      ESP_LOGI(TAG, "retry to connect to the AP");
-    }
-    ESP_LOGI(TAG, "connect to the AP fail");
+    handle_disconnect((wifi_event_sta_disconnected_t*)event_data);
   } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
-    ip_event_got_ip_t* event = (ip_event_got_ip_t*)event_data;
-    ESP_LOGI(TAG, "Obtained IP address: %s", ip4addr_ntoa(&event->ip_info.ip));
-    s_retry_num = 0;
-    xEventGroupSetBits(wifi_event_group, WIFI_CONNECTED_BIT);
+    handle_got_ip((ip_event_got_ip_t*)event_data);
   }
 }
 
 /**
- * Starts process of connecting to Wi-Fi, but doesn't block
+ * Starts process of connecting to Wi-Fi, but doesn't block. Lost connections are retried forever, with
+ * jittered exponential backoff between attempts.
  */
 void initialize_wifi_in_station_mode(void) {
   wifi_event_group = xEventGroupCreate();
+  disconnected_at = esp_timer_get_time();
+
+  const esp_timer_create_args_t reconnect_timer_args = {.callback = &reconnect_timer_callback,
+                                                        .name = "wifi_reconnect"};
+  ESP_ERROR_CHECK(esp_timer_create(&reconnect_timer_args, &reconnect_timer));
 
   tcpip_adapter_init();
 
@@ -75,28 +148,42 @@ void initialize_wifi_in_station_mode(void) {
 }
 
 /**
- * Block, waiting for IP address from Wi-Fi connection
+ * Block for up to timeout_ms waiting for an IP address from the Wi-Fi connection. Returns whether there is one,
+ * reconnecting carries on in the background either way.
  */
-void wait_for_ip(void) {
-  ESP_LOGI(TAG, "Waiting for IP address");
-  EventBits_t uxBits = xEventGroupWaitBits(wifi_event_group, WIFI_CONNECTED_BIT, false, true, pdMS_TO_TICKS(10000));
+bool wait_for_ip(uint32_t timeout_ms) {
+  ESP_LOGI(TAG, "Waiting up to %u ms for IP address", timeout_ms);
+  EventBits_t uxBits = xEventGroupWaitBits(wifi_event_group, WIFI_CONNECTED_BIT, false, true, pdMS_TO_TICKS(timeout_ms));
+  return (uxBits & WIFI_CONNECTED_BIT) != 0;
+}
 
-  if (uxBits && WIFI_CONNECTED_BIT) {
-    return;
-  }
+bool wifi_is_connected(void) { return (xEventGroupGetBits(wifi_event_group) & WIFI_CONNECTED_BIT) != 0; }
+
+void wifi_get_status(struct WifiStatus* result) {
+  wifi_ap_record_t ap_info;
+  bool have_ap_info = wifi_is_connected() && esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK;
+  int64_t now = esp_timer_get_time();
 
-  if (connection_delay <= (1000000LL * 1024)) {  // roughly 17 minutes
-    // Wait twice as long as the time before
-    connection_delay *= 2;
+  portENTER_CRITICAL(&lock);
+  if (have_ap_info) {
+    status.rssi = ap_info.rssi;
   }
+  *result = status;
+  result->connected_seconds = status.state == WIFI_STATE_CONNECTED ? (uint32_t)((now - connected_at) / 1000000) : 0;
+  portEXIT_CRITICAL(&lock);
+}
 
-  long long int minutes = (connection_delay / 1000000LL) / 60;
-  long long int seconds = (connection_delay / 1000000LL) % 60;
-  if (minutes > 0) {
-    ESP_LOGI(TAG, "Failed to get an IP address, so going to sleep for %lld minutes and %lld seconds", minutes, seconds);
-  } else {
-    ESP_LOGI(TAG, "Failed to get an IP address, so going to sleep for %lld seconds", seconds);
-    vTaskDelay(pdMS_TO_TICKS(1000));
-    esp_deep_sleep(connection_delay);
+const char* wifi_state_name(enum WifiState state) {
+  switch (state) {
+    case WIFI_STATE_STARTING:
+      return "starting";
+    case WIFI_STATE_CONNECTING:
+      return "connecting";
+    case WIFI_STATE_CONNECTED:
+      return "connected";
+    case WIFI_STATE_BACKOFF:
+      return "backoff";
+    default:
+      return "unknown";
   }
 }
@@ -1,7 +1,33 @@
 #ifndef wifi_helper_h
 #define wifi_helper_h
 
+#include <stdbool.h>
+#include <stdint.h>
+
+enum WifiState {
+  WIFI_STATE_STARTING,
+  WIFI_STATE_CONNECTING,
+  WIFI_STATE_CONNECTED,
+  // Waiting out the delay before the next connection attempt
+  WIFI_STATE_BACKOFF
+};
+
+struct WifiStatus {
+  enum WifiState state;
+  int8_t rssi;
+  uint32_t connected_seconds;
+  uint32_t disconnect_count;
+  uint32_t consecutive_failures;
+  int last_disconnect_reason;
+  // From losing the connection (or boot) to having an IP address again
+  uint32_t reconnect_latency_ms;
+  uint32_t max_reconnect_latency_ms;
+};
+
 void initialize_wifi_in_station_mode();
-void wait_for_ip();
+bool wait_for_ip(uint32_t timeout_ms);
+bool wifi_is_connected(void);
+void wifi_get_status(struct WifiStatus* status);
+const char* wifi_state_name(enum WifiState state);
 
 #endif
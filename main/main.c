@@ -1,20 +1,25 @@
+#include "actuator.h"
 #include "bme280_helper.h"
 #include "chicken_incubator.h"
+#include "delta_ota.h"
 #include "esp_event.h"
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "heater.h"
-#include "humidifier.h"
 #include "nvs_flash.h"
 #include "sntp_helper.h"
+#include "telemetry.h"
 #include "uln2003_stepper_driver.h"
 #include "wifi_helper.h"
 #include "chicken_incubator.h"
 #include "mqtt_helper.h"
+#include "safety_supervisor.h"
 
 static const char* TAG = "Main";
 
+// How long startup waits on the network before getting on without it
+static const uint32_t NETWORK_WAIT_MS = 10000;
+
 /* Variable holding number of times ESP32 restarted since first boot.
  * It is placed into RTC memory using RTC_DATA_ATTR and
  * maintains its value when ESP32 wakes from deep sleep.
@@ -48,31 +53,40 @@ void app_main(void) {
   ++boot_count;
   ESP_LOGI(TAG, "Boot count: %d", boot_count);
   initialize();
-  initialize_heater();
-  initialize_humidifier();
-
-  ESP_ERROR_CHECK(esp_event_handler_register(SENSOR_EVENTS, SENSOR_READING_TEMPERATURE, chicken_temperature_reading_handler, NULL));
-  ESP_ERROR_CHECK(esp_event_handler_register(SENSOR_EVENTS, SENSOR_READING_HUMIDITY, chicken_humidity_reading_handler, NULL));
+  initialize_actuators();
 
-  initialize_wifi_in_station_mode();
-  wait_for_ip();
-  initialize_mqtt();
+  ESP_ERROR_CHECK(sensor_event_handler_register(SENSOR_READING_TEMPERATURE, chicken_temperature_reading_handler));
+  ESP_ERROR_CHECK(sensor_event_handler_register(SENSOR_READING_HUMIDITY, chicken_humidity_reading_handler));
+  ESP_ERROR_CHECK(sensor_event_handler_register(SENSOR_READING_PRESSURE, chicken_pressure_reading_handler));
 
   time_t now;
   set_current_time(&now);
 
-  if (!time_is_set(now) || time_is_stale(now)) {
-    ESP_LOGI(TAG, "Time has either not been set or become stale. Connecting to WiFi and syncing time over NTP.");
-    wait_for_ip();
-    obtain_time(&now);
+  // Control doesn't need the network, so it starts first and keeps running whatever Wi-Fi is doing
+  start_safety_supervisor();
+  start_bme280_read_tasks();
+
+  initialize_wifi_in_station_mode();
+  initialize_mqtt();
+
+  // Time is synced in the background, the RTC carries it across resets until then
+  start_sntp();
+  if (!time_is_set(now)) {
+    ESP_LOGW(TAG, "Time has not been set, timestamps will be wrong until the first sync with NTP");
+  } else if (time_is_stale(now)) {
+    ESP_LOGI(TAG, "Time is stale, running on holdover until the next sync with NTP");
   }
 
-  wait_for_mqtt_to_connect();
+  wait_for_mqtt_to_connect(NETWORK_WAIT_MS);
 
   char strftime_buf[64];
   get_time_string(strftime_buf);
   ESP_LOGI(TAG, "Time is: %s", strftime_buf);
 
-  start_bme280_read_tasks();
   chicken_start();
+  start_telemetry();
+
+  // Everything came up, so if this is a fresh update it's safe to keep
+  mark_running_image_valid();
+  start_delta_ota_updates();
 }
@@ -6,6 +6,7 @@ CREATE DATABASE incubator;
 CREATE TABLE temperature ( 
   id              serial primary key, 
   temperature numeric NOT NULL,
+  sensor_address varchar (4),
   mac varchar (17) NOT NULL,
   created_at timestamptz NOT NULL DEFAULT now(),
   client_time timestamp NOT NULL
@@ -14,6 +15,11 @@ CREATE TABLE temperature (
 CREATE TABLE humidity ( 
   id              serial primary key, 
   humidity numeric NOT NULL,
+  dew_point numeric,
+  absolute_humidity numeric,
+  vapour_pressure_deficit numeric,
+  pressure numeric,
+  sensor_address varchar (4),
   mac varchar (17) NOT NULL,
   created_at timestamptz NOT NULL DEFAULT now(),
   client_time timestamp NOT NULL
@@ -25,4 +31,17 @@ CREATE TABLE egg_turner (
   mac varchar (17) NOT NULL,
   created_at timestamptz NOT NULL DEFAULT now(),
   client_time timestamp NOT NULL
-);
\ No newline at end of file
+);
+
+CREATE TABLE actuator_switch ( 
+  id              serial primary key, 
+  actuator varchar (16) NOT NULL,
+  state varchar (8) NOT NULL,
+  mac varchar (17) NOT NULL,
+  created_at timestamptz NOT NULL DEFAULT now(),
+  client_time timestamp NOT NULL
+);
+
+-- For the query service, which always reads one device over a time window
+CREATE INDEX temperature_mac_client_time ON temperature (mac, client_time);
+CREATE INDEX humidity_mac_client_time ON humidity (mac, client_time);
\ No newline at end of file
@@ -0,0 +1,317 @@
+/*
+ * Host side of delta OTA updates.
+ *
+ *   delta_tool diff [-u] <running.bin> <new.bin> <out.delta>   generate a delta to serve to devices, -u leaves
+ *                                                              it uncompressed for firmware that predates that
+ *   delta_tool apply <running.bin> <in.delta> <out.bin>        apply one with the same code the device runs
+ *
+ * Build with `make` in this directory.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "delta_patch.h"
+
+#define BLOCK_SIZE 8
+#define MIN_MATCH 12
+#define MAX_CHAIN 32
+#define APPLY_CHUNK_SIZE 4096
+
+struct Buffer {
+  uint8_t *data;
+  size_t length;
+  size_t capacity;
+};
+
+static int read_file(const char *path, struct Buffer *buffer) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    perror(path);
+    return -1;
+  }
+  fseek(file, 0, SEEK_END);
+  long length = ftell(file);
+  fseek(file, 0, SEEK_SET);
+
+  buffer->data = malloc(length > 0 ? length : 1);
+  buffer->length = buffer->capacity = length;
+  if (fread(buffer->data, 1, length, file) != (size_t)length) {
+    perror(path);
+    fclose(file);
+    return -1;
+  }
+  fclose(file);
+  return 0;
+}
+
+static void append(struct Buffer *buffer, const uint8_t *data, size_t length) {
+  if (buffer->length + length > buffer->capacity) {
+    buffer->capacity = (buffer->length + length) * 2;
+    buffer->data = realloc(buffer->data, buffer->capacity);
+  }
+  memcpy(buffer->data + buffer->length, data, length);
+  buffer->length += length;
+}
+
+static void append_u32(struct Buffer *buffer, uint32_t value) {
+  uint8_t bytes[4] = {value & 0xFF, (value >> 8) & 0xFF, (value >> 16) & 0xFF, (value >> 24) & 0xFF};
+  append(buffer, bytes, 4);
+}
+
+static void append_varint(struct Buffer *buffer, uint64_t value) {
+  do {
+    uint8_t byte = value & 0x7F;
+    value >>= 7;
+    if (value != 0) {
+      byte |= 0x80;
+    }
+    append(buffer, &byte, 1);
+  } while (value != 0);
+}
+
+static void append_insert(struct Buffer *delta, const uint8_t *data, size_t length) {
+  if (length == 0) {
+    return;
+  }
+  uint8_t op = DELTA_OP_INSERT;
+  append(delta, &op, 1);
+  append_varint(delta, length);
+  append(delta, data, length);
+}
+
+static void append_copy(struct Buffer *delta, int64_t relative_offset, size_t length) {
+  uint8_t op = DELTA_OP_COPY;
+  append(delta, &op, 1);
+  append_varint(delta, ((uint64_t)relative_offset << 1) ^ (uint64_t)(relative_offset >> 63));
+  append_varint(delta, length);
+}
+
+static uint32_t hash_block(const uint8_t *data, uint32_t mask) {
+  uint64_t value;
+  memcpy(&value, data, BLOCK_SIZE);
+  return (uint32_t)((value * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+}
+
+static size_t match_length(const struct Buffer *source, size_t source_offset, const struct Buffer *target,
+                           size_t target_offset) {
+  size_t length = 0;
+  while (source_offset + length < source->length && target_offset + length < target->length &&
+         source->data[source_offset + length] == target->data[target_offset + length]) {
+    length++;
+  }
+  return length;
+}
+
+/*
+ * Greedy matcher over a hash of every 8 byte block in the source. The candidate that keeps the same
+ * source/target displacement as the previous copy is tried first, since most of an image just shifts
+ * when code changes.
+ */
+static void generate_ops(const struct Buffer *source, const struct Buffer *target, struct Buffer *delta) {
+  uint32_t buckets = 1;
+  while (buckets < source->length) {
+    buckets <<= 1;
+  }
+  int32_t *heads = malloc(buckets * sizeof(int32_t));
+  int32_t *chain = malloc((source->length + 1) * sizeof(int32_t));
+  memset(heads, 0xFF, buckets * sizeof(int32_t));
+  for (size_t i = 0; i + BLOCK_SIZE <= source->length; i++) {
+    uint32_t hash = hash_block(source->data + i, buckets - 1);
+    chain[i] = heads[hash];
+    heads[hash] = (int32_t)i;
+  }
+
+  size_t source_position = 0;
+  int64_t displacement = 0;
+  size_t literal_start = 0;
+  size_t i = 0;
+  while (i + BLOCK_SIZE <= target->length) {
+    size_t best_offset = 0;
+    size_t best_length = 0;
+
+    int64_t expected = (int64_t)i + displacement;
+    if (expected >= 0 && (size_t)expected < source->length) {
+      best_offset = expected;
+      best_length = match_length(source, expected, target, i);
+    }
+
+    int32_t candidate = heads[hash_block(target->data + i, buckets - 1)];
+    for (int n = 0; candidate >= 0 && n < MAX_CHAIN; n++, candidate = chain[candidate]) {
+      size_t length = match_length(source, candidate, target, i);
+      if (length > best_length) {
+        best_offset = candidate;
+        best_length = length;
+      }
+    }
+
+    if (best_length < MIN_MATCH) {
+      i++;
+      continue;
+    }
+
+    append_insert(delta, target->data + literal_start, i - literal_start);
+    append_copy(delta, (int64_t)best_offset - (int64_t)source_position, best_length);
+    source_position = best_offset + best_length;
+    displacement = (int64_t)best_offset - (int64_t)i;
+    i += best_length;
+    literal_start = i;
+  }
+  append_insert(delta, target->data + literal_start, target->length - literal_start);
+
+  free(heads);
+  free(chain);
+}
+
+/* Raw deflate at the highest level, the device's inflater takes the 32 KB window that needs */
+static int compress_ops(const struct Buffer *ops, struct Buffer *delta) {
+  z_stream stream = {0};
+  if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, -15, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+    return -1;
+  }
+  size_t bound = deflateBound(&stream, ops->length);
+  if (delta->length + bound > delta->capacity) {
+    delta->capacity = delta->length + bound;
+    delta->data = realloc(delta->data, delta->capacity);
+  }
+  stream.next_in = ops->data;
+  stream.avail_in = ops->length;
+  stream.next_out = delta->data + delta->length;
+  stream.avail_out = bound;
+  int status = deflate(&stream, Z_FINISH);
+  delta->length += bound - stream.avail_out;
+  deflateEnd(&stream);
+  return status == Z_STREAM_END ? 0 : -1;
+}
+
+static int generate_delta(const struct Buffer *source, const struct Buffer *target, bool compress,
+                          struct Buffer *delta, size_t *ops_length) {
+  append(delta, (const uint8_t *)DELTA_MAGIC, 4);
+  uint8_t version[4] = {compress ? DELTA_VERSION_COMPRESSED : DELTA_VERSION_UNCOMPRESSED, 0, 0, 0};
+  append(delta, version, 4);
+  append_u32(delta, source->length);
+  append_u32(delta, delta_crc32(0, source->data, source->length));
+  append_u32(delta, target->length);
+  append_u32(delta, delta_crc32(0, target->data, target->length));
+
+  if (!compress) {
+    generate_ops(source, target, delta);
+    *ops_length = delta->length - DELTA_HEADER_SIZE;
+    return 0;
+  }
+
+  struct Buffer ops = {0};
+  generate_ops(source, target, &ops);
+  *ops_length = ops.length;
+  int result = compress_ops(&ops, delta);
+  free(ops.data);
+  return result;
+}
+
+static int write_file(const char *path, const struct Buffer *buffer) {
+  FILE *file = fopen(path, "wb");
+  if (file == NULL || fwrite(buffer->data, 1, buffer->length, file) != buffer->length) {
+    perror(path);
+    return -1;
+  }
+  fclose(file);
+  return 0;
+}
+
+static int diff(const char *source_path, const char *target_path, const char *delta_path, bool compress) {
+  struct Buffer source, target, delta = {0};
+  if (read_file(source_path, &source) != 0 || read_file(target_path, &target) != 0) {
+    return 1;
+  }
+
+  size_t ops_length;
+  if (generate_delta(&source, &target, compress, &delta, &ops_length) != 0) {
+    fprintf(stderr, "Failed to compress %s\n", delta_path);
+    return 1;
+  }
+  if (write_file(delta_path, &delta) != 0) {
+    return 1;
+  }
+
+  printf("%s: %zu bytes (%zu of operations before compression), %.1f%% of the %zu byte image\n", delta_path,
+         delta.length, ops_length, target.length > 0 ? 100.0 * delta.length / target.length : 0.0, target.length);
+  return 0;
+}
+
+struct ApplyContext {
+  const struct Buffer *source;
+  FILE *target;
+};
+
+static int read_source(void *context, uint32_t offset, uint8_t *buffer, size_t length) {
+  const struct ApplyContext *apply = context;
+  if ((size_t)offset + length > apply->source->length) {
+    return -1;
+  }
+  memcpy(buffer, apply->source->data + offset, length);
+  return 0;
+}
+
+static int write_target(void *context, const uint8_t *data, size_t length) {
+  const struct ApplyContext *apply = context;
+  return fwrite(data, 1, length, apply->target) == length ? 0 : -1;
+}
+
+static int apply(const char *source_path, const char *delta_path, const char *target_path) {
+  struct Buffer source;
+  if (read_file(source_path, &source) != 0) {
+    return 1;
+  }
+  FILE *delta = fopen(delta_path, "rb");
+  FILE *target = fopen(target_path, "wb");
+  if (delta == NULL || target == NULL) {
+    perror(delta == NULL ? delta_path : target_path);
+    return 1;
+  }
+
+  struct ApplyContext context = {.source = &source, .target = target};
+  struct DeltaPatch patch;
+  delta_patch_init(&patch, source.length, delta_crc32(0, source.data, source.length), read_source, write_target,
+                   &context);
+
+  // Fed in chunks like the device gets them off the network, not all at once
+  uint8_t chunk[APPLY_CHUNK_SIZE];
+  size_t read;
+  int result = DELTA_OK;
+  while (result == DELTA_OK && (read = fread(chunk, 1, sizeof(chunk), delta)) > 0) {
+    result = delta_patch_feed(&patch, chunk, read);
+  }
+  if (result == DELTA_OK) {
+    result = delta_patch_finish(&patch);
+  }
+  delta_patch_release(&patch);
+  fclose(delta);
+  fclose(target);
+
+  if (result != DELTA_OK) {
+    fprintf(stderr, "Failed to apply %s: %s\n", delta_path, delta_result_name(result));
+    return 1;
+  }
+  printf("%s: %u bytes, CRC-32 %08x\n", target_path, patch.written, patch.crc);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc == 5 && strcmp(argv[1], "diff") == 0) {
+    return diff(argv[2], argv[3], argv[4], true);
+  }
+  if (argc == 6 && strcmp(argv[1], "diff") == 0 && strcmp(argv[2], "-u") == 0) {
+    return diff(argv[3], argv[4], argv[5], false);
+  }
+  if (argc == 5 && strcmp(argv[1], "apply") == 0) {
+    return apply(argv[2], argv[3], argv[4]);
+  }
+  fprintf(stderr,
+          "Usage: %s diff [-u] <running.bin> <new.bin> <out.delta>\n"
+          "       %s apply <running.bin> <in.delta> <out.bin>\n",
+          argv[0], argv[0]);
+  return 2;
+}
@@ -0,0 +1,107 @@
+#include "fakes.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "driver/gpio.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/task.h"
+#include "heap_guard.h"
+#include "sdkconfig.h"
+#include "task_monitor.h"
+
+static int64_t now_us;
+static bool verbose;
+
+// The heap guard for the one task a test plays, see heap_guard_watch_current_task
+static bool watching;
+static bool float_formatted;
+static uint32_t cycles;
+static uint32_t cycle_allocations;
+static uint32_t steady_state_allocations;
+
+void fake_set_time(int64_t time_us) { now_us = time_us; }
+
+void fake_set_verbose(bool enabled) { verbose = enabled; }
+
+// Whether format has a floating point conversion, which newlib hands to _dtoa
+static bool formats_float(const char *format) {
+  for (const char *c = format; *c != '\0'; c++) {
+    if (*c != '%') {
+      continue;
+    }
+    c++;
+    while (*c != '\0' && strchr("-+ #0123456789.*hlLqjzt", *c) != NULL) {
+      c++;
+    }
+    if (*c == '\0') {
+      break;
+    }
+    if (strchr("fFeEgGaA", *c) != NULL) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void fake_log(char level, const char *tag, const char *format, ...) {
+  // Newlib allocates _dtoa's bigints in the task's reent the first time it formats a float, as an allocation
+  // that's the task's first, and only, float log
+  if (!float_formatted && formats_float(format)) {
+    float_formatted = true;
+    if (watching) {
+      cycle_allocations++;
+    }
+  }
+  if (!verbose) {
+    return;
+  }
+  va_list args;
+  va_start(args, format);
+  printf("%c (%lld) %s: ", level, (long long)(now_us / 1000), tag);
+  vprintf(format, args);
+  printf("\n");
+  va_end(args);
+}
+
+int64_t esp_timer_get_time(void) { return now_us; }
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level) { return ESP_OK; }
+
+void pinModeOutput(uint8_t pin) {}
+
+// Tasks are never started, tests call what their loops would
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t task, const char *name, uint32_t stack_depth, void *parameters,
+                                           UBaseType_t priority, StackType_t *stack, StaticTask_t *task_buffer,
+                                           BaseType_t core) {
+  return NULL;
+}
+
+TickType_t xTaskGetTickCount(void) { return (TickType_t)(now_us / 1000); }
+
+void vTaskDelayUntil(TickType_t *previous_wake_time, TickType_t time_increment) {}
+
+/* The watched task is a fresh one on the device, with a reent of its own, so whatever the test formatted
+ * before playing it doesn't count */
+void heap_guard_watch_current_task(void) {
+  watching = true;
+  float_formatted = false;
+}
+
+// As heap_guard.c counts it, less the abort
+void heap_guard_end_cycle(void) {
+  if (!watching) {
+    return;
+  }
+  cycles++;
+  if (cycles > CONFIG_HEAP_GUARD_WARMUP_CYCLES) {
+    steady_state_allocations += cycle_allocations;
+  }
+  cycle_allocations = 0;
+}
+
+uint32_t heap_guard_steady_state_allocations(void) { return steady_state_allocations; }
+
+void task_monitor_record_latency(enum LatencySource source, int64_t latency_us) {}
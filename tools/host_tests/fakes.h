@@ -0,0 +1,12 @@
+#ifndef fakes_h
+#define fakes_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* What the firmware sources under test see of the outside world. Time only moves when the test says so. */
+
+void fake_set_time(int64_t time_us);
+void fake_set_verbose(bool verbose);
+
+#endif
@@ -0,0 +1,12 @@
+#include "host_test.h"
+
+int host_test_failures;
+
+int host_test_result(const char *name) {
+  if (host_test_failures > 0) {
+    printf("%s: %d checks failed\n", name, host_test_failures);
+    return 1;
+  }
+  printf("%s: passed\n", name);
+  return 0;
+}
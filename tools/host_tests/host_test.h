@@ -0,0 +1,23 @@
+#ifndef host_test_h
+#define host_test_h
+
+#include <stdio.h>
+
+/* Just enough of a test framework. A failed CHECK prints where and carries on, so one run shows every failure,
+ * and the test exits with host_test_result(). */
+
+extern int host_test_failures;
+
+#define CHECK(condition, ...)                                      \
+  do {                                                             \
+    if (!(condition)) {                                            \
+      host_test_failures++;                                        \
+      printf("%s:%d: check failed: %s: ", __FILE__, __LINE__, #condition); \
+      printf(__VA_ARGS__);                                         \
+      printf("\n");                                                \
+    }                                                              \
+  } while (0)
+
+int host_test_result(const char *name);
+
+#endif
@@ -0,0 +1,299 @@
+/*
+ * Delta OTA round trips over image files.
+ *
+ * Each case writes a running and a new image, has delta_tool diff them in both formats and apply the result,
+ * then applies it again in-process a byte and a few bytes at a time, the way the device is fed off the network.
+ * Deltas against the wrong base, cut short or corrupted have to be rejected.
+ *
+ * delta_tool is found next to this test in ../delta_tool, or wherever DELTA_TOOL points.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "delta_patch.h"
+#include "host_test.h"
+
+#define IMAGE_SIZE (96 * 1024)
+
+struct Image {
+  uint8_t *data;
+  size_t length;
+};
+
+static char directory[] = "/tmp/test_delta_patch.XXXXXX";
+static char delta_tool[512];
+
+static struct Image image_copy(const struct Image *image) {
+  struct Image copy = {malloc(image->length + 1), image->length};
+  memcpy(copy.data, image->data, image->length);
+  return copy;
+}
+
+// Stands in for firmware, incompressible code with runs of strings in between
+static struct Image firmware_image(void) {
+  static const char *strings[] = {"Failed to read sensor %X: %s", "Turning %s %s", "incubator/readings",
+                                  "Interlock tripped (%s)"};
+  struct Image image = {malloc(IMAGE_SIZE), IMAGE_SIZE};
+  uint32_t random = 1;
+  size_t i = 0;
+  while (i < IMAGE_SIZE) {
+    random = random * 1103515245 + 12345;
+    if ((random >> 16) % 8 == 0) {
+      const char *string = strings[(random >> 20) % 4];
+      for (size_t j = 0; string[j] != '\0' && i < IMAGE_SIZE; j++) {
+        image.data[i++] = string[j];
+      }
+    } else {
+      image.data[i++] = random >> 24;
+    }
+  }
+  return image;
+}
+
+static struct Image image_insert(const struct Image *image, size_t at, const char *text, size_t length) {
+  struct Image result = {malloc(image->length + length), image->length + length};
+  memcpy(result.data, image->data, at);
+  for (size_t i = 0; i < length; i++) {
+    result.data[at + i] = text[i % strlen(text)];
+  }
+  memcpy(result.data + at + length, image->data + at, image->length - at);
+  return result;
+}
+
+static struct Image image_delete(const struct Image *image, size_t at, size_t length) {
+  struct Image result = {malloc(image->length - length), image->length - length};
+  memcpy(result.data, image->data, at);
+  memcpy(result.data + at, image->data + at + length, image->length - at - length);
+  return result;
+}
+
+static struct Image image_edit(const struct Image *image) {
+  struct Image result = image_copy(image);
+  for (size_t i = 1000; i < result.length; i += 4099) {
+    result.data[i] ^= 0x5A;
+  }
+  return result;
+}
+
+static char *path(const char *name) {
+  static char paths[4][256];
+  static int next;
+  char *result = paths[next++ % 4];
+  snprintf(result, sizeof(paths[0]), "%s/%s", directory, name);
+  return result;
+}
+
+static void write_image(const char *name, const struct Image *image) {
+  FILE *file = fopen(path(name), "wb");
+  if (file == NULL || fwrite(image->data, 1, image->length, file) != image->length) {
+    perror(path(name));
+    exit(1);
+  }
+  fclose(file);
+}
+
+static struct Image read_image(const char *name) {
+  struct Image image = {NULL, 0};
+  FILE *file = fopen(path(name), "rb");
+  if (file == NULL) {
+    return image;
+  }
+  fseek(file, 0, SEEK_END);
+  image.length = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  image.data = malloc(image.length + 1);
+  if (fread(image.data, 1, image.length, file) != image.length) {
+    image.length = 0;
+  }
+  fclose(file);
+  return image;
+}
+
+static bool images_equal(const struct Image *a, const struct Image *b) {
+  return a->length == b->length && (a->length == 0 || memcmp(a->data, b->data, a->length) == 0);
+}
+
+static int run_tool(const char *command, const char *a, const char *b, const char *c) {
+  char line[1024];
+  snprintf(line, sizeof(line), "%s %s %s %s %s > /dev/null 2>&1", delta_tool, command, path(a), path(b), path(c));
+  int status = system(line);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+struct ApplyContext {
+  const struct Image *source;
+  struct Image target;
+};
+
+static int read_source(void *context, uint32_t offset, uint8_t *buffer, size_t length) {
+  const struct ApplyContext *apply = context;
+  if ((size_t)offset + length > apply->source->length) {
+    return -1;
+  }
+  memcpy(buffer, apply->source->data + offset, length);
+  return 0;
+}
+
+static int write_target(void *context, const uint8_t *data, size_t length) {
+  struct ApplyContext *apply = context;
+  apply->target.data = realloc(apply->target.data, apply->target.length + length + 1);
+  memcpy(apply->target.data + apply->target.length, data, length);
+  apply->target.length += length;
+  return 0;
+}
+
+/* The device's side, returns the first error from feeding or finishing */
+static int apply_in_chunks(const struct Image *source, const struct Image *delta, size_t chunk, struct Image *target) {
+  struct ApplyContext context = {.source = source};
+  struct DeltaPatch patch;
+  delta_patch_init(&patch, source->length, delta_crc32(0, source->data, source->length), read_source, write_target,
+                   &context);
+  int result = DELTA_OK;
+  for (size_t i = 0; i < delta->length && result == DELTA_OK; i += chunk) {
+    result = delta_patch_feed(&patch, delta->data + i, delta->length - i < chunk ? delta->length - i : chunk);
+  }
+  if (result == DELTA_OK) {
+    result = delta_patch_finish(&patch);
+  }
+  delta_patch_release(&patch);
+  *target = context.target;
+  return result;
+}
+
+static void check_round_trip(const char *name, const struct Image *source, const struct Image *target) {
+  static const size_t CHUNKS[] = {1, 7, 1024};
+  write_image("source.bin", source);
+  write_image("target.bin", target);
+
+  size_t lengths[2];
+  for (int compress = 0; compress < 2; compress++) {
+    const char *format = compress ? "compressed" : "uncompressed";
+    int status = compress ? run_tool("diff", "source.bin", "target.bin", "image.delta")
+                          : run_tool("diff -u", "source.bin", "target.bin", "image.delta");
+    CHECK(status == 0, "%s, %s: diff exited %d", name, format, status);
+
+    struct Image delta = read_image("image.delta");
+    lengths[compress] = delta.length;
+    CHECK(delta.length >= DELTA_HEADER_SIZE && delta.data[4] == (compress ? DELTA_VERSION_COMPRESSED
+                                                                          : DELTA_VERSION_UNCOMPRESSED),
+          "%s, %s: not a version %d delta", name, format, compress ? 2 : 1);
+
+    status = run_tool("apply", "source.bin", "image.delta", "patched.bin");
+    struct Image patched = read_image("patched.bin");
+    CHECK(status == 0 && images_equal(&patched, target), "%s, %s: delta_tool apply exited %d, %zu of %zu bytes",
+          name, format, status, patched.length, target->length);
+    free(patched.data);
+
+    for (size_t i = 0; i < sizeof(CHUNKS) / sizeof(CHUNKS[0]); i++) {
+      int result = apply_in_chunks(source, &delta, CHUNKS[i], &patched);
+      CHECK(result == DELTA_OK && images_equal(&patched, target), "%s, %s, %zu byte chunks: %s, %zu of %zu bytes",
+            name, format, CHUNKS[i], delta_result_name(result), patched.length, target->length);
+      free(patched.data);
+    }
+    free(delta.data);
+  }
+
+  // Some slack for the deflate framing on deltas with nothing to squeeze
+  CHECK(lengths[1] <= lengths[0] + 16, "%s: compressed delta is %zu bytes, uncompressed %zu", name, lengths[1],
+        lengths[0]);
+}
+
+static void check_rejected(const char *name, const struct Image *source, const struct Image *delta,
+                           int expected_result) {
+  write_image("source.bin", source);
+  write_image("image.delta", delta);
+  int status = run_tool("apply", "source.bin", "image.delta", "patched.bin");
+  CHECK(status != 0, "%s: delta_tool apply accepted it", name);
+
+  struct Image patched;
+  int result = apply_in_chunks(source, delta, 7, &patched);
+  CHECK(expected_result == DELTA_OK ? result != DELTA_OK : result == expected_result, "%s: %s", name,
+        delta_result_name(result));
+  free(patched.data);
+}
+
+static void check_bad_deltas(const struct Image *source, const struct Image *target) {
+  write_image("source.bin", source);
+  write_image("target.bin", target);
+  run_tool("diff", "source.bin", "target.bin", "image.delta");
+  struct Image delta = read_image("image.delta");
+  run_tool("diff -u", "source.bin", "target.bin", "image.delta");
+  struct Image uncompressed = read_image("image.delta");
+
+  struct Image other_base = image_edit(source);
+  check_rejected("wrong base", &other_base, &delta, DELTA_ERR_SOURCE_MISMATCH);
+  check_rejected("wrong base, uncompressed", &other_base, &uncompressed, DELTA_ERR_SOURCE_MISMATCH);
+  struct Image shorter_base = image_delete(source, 0, 1);
+  check_rejected("wrong base size", &shorter_base, &delta, DELTA_ERR_SOURCE_MISMATCH);
+
+  struct Image truncated = image_copy(&delta);
+  truncated.length -= 10;
+  check_rejected("truncated", source, &truncated, DELTA_OK);
+  struct Image header_only = image_copy(&delta);
+  header_only.length = DELTA_HEADER_SIZE - 1;
+  check_rejected("truncated header", source, &header_only, DELTA_ERR_BAD_HEADER);
+
+  struct Image corrupted = image_copy(&delta);
+  corrupted.data[corrupted.length / 2] ^= 0xFF;
+  check_rejected("corrupted", source, &corrupted, DELTA_OK);
+
+  struct Image trailing = image_copy(&delta);
+  trailing.data = realloc(trailing.data, trailing.length + 1);
+  trailing.data[trailing.length++] = 0;
+  check_rejected("trailing bytes", source, &trailing, DELTA_ERR_INFLATE);
+
+  struct Image future = image_copy(&delta);
+  future.data[4] = DELTA_VERSION_COMPRESSED + 1;
+  check_rejected("unknown version", source, &future, DELTA_ERR_BAD_HEADER);
+}
+
+int main(int argc, char *argv[]) {
+  if (getenv("DELTA_TOOL") != NULL) {
+    snprintf(delta_tool, sizeof(delta_tool), "%s", getenv("DELTA_TOOL"));
+  } else {
+    const char *slash = strrchr(argv[0], '/');
+    int length = slash != NULL ? (int)(slash - argv[0]) : 1;
+    snprintf(delta_tool, sizeof(delta_tool), "%.*s/../delta_tool/delta_tool", length, slash != NULL ? argv[0] : ".");
+  }
+  if (mkdtemp(directory) == NULL) {
+    perror(directory);
+    return 1;
+  }
+
+  struct Image firmware = firmware_image();
+  struct Image empty = {malloc(1), 0};
+  struct Image inserted = image_insert(&firmware, 20000, "log line added in the new build ", 3000);
+  struct Image deleted = image_delete(&firmware, 30000, 5000);
+  struct Image edited = image_edit(&firmware);
+
+  check_round_trip("unchanged", &firmware, &firmware);
+  check_round_trip("insert", &firmware, &inserted);
+  check_round_trip("delete", &firmware, &deleted);
+  check_round_trip("edit", &firmware, &edited);
+  check_round_trip("empty source", &empty, &firmware);
+  check_round_trip("empty target", &firmware, &empty);
+  check_round_trip("both empty", &empty, &empty);
+  check_bad_deltas(&firmware, &inserted);
+
+  // The inserted text is what compression is for
+  write_image("source.bin", &firmware);
+  write_image("target.bin", &inserted);
+  run_tool("diff", "source.bin", "target.bin", "image.delta");
+  struct Image compressed = read_image("image.delta");
+  run_tool("diff -u", "source.bin", "target.bin", "image.delta");
+  struct Image uncompressed = read_image("image.delta");
+  CHECK(compressed.length * 4 < uncompressed.length, "insert: compressed delta is %zu bytes, uncompressed %zu",
+        compressed.length, uncompressed.length);
+
+  char command[256];
+  snprintf(command, sizeof(command), "rm -rf %s", directory);
+  if (system(command) != 0) {
+    printf("Failed to remove %s\n", directory);
+  }
+  return host_test_result("test_delta_patch");
+}
@@ -0,0 +1,175 @@
+/*
+ * The error bounds psychrometrics.h documents, against libm.
+ *
+ * fast_expf and fast_logf are swept over their documented ranges, then every result of compute_psychrometrics
+ * over the incubator's range of temperature, humidity and pressure is held against the same Magnus and Buck
+ * formulas in double precision. -v prints the worst error of each.
+ */
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "host_test.h"
+#include "psychrometrics.h"
+
+// As documented in psychrometrics.h
+#define EXP_RELATIVE_ERROR 2e-7
+#define EXP_RANGE 20.0f
+#define LOG_ABSOLUTE_ERROR 5e-7
+#define LOG_MINIMUM 1e-3f
+#define LOG_MAXIMUM 1e3f
+#define RESULT_ABSOLUTE_ERROR 1e-4
+#define MAGNUS_RELATIVE_ERROR 0.003
+
+#define EXP_POINTS 4000000
+// Every 64th float is a couple of million points, and still hits every exponent many times over
+#define LOG_FLOAT_STRIDE 64
+
+static bool verbose;
+
+static float float_after(float x, uint32_t steps) {
+  uint32_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+  bits += steps;
+  memcpy(&x, &bits, sizeof(x));
+  return x;
+}
+
+static void check_exp(void) {
+  double worst = 0;
+  float worst_at = 0;
+  for (int i = 0; i <= EXP_POINTS; i++) {
+    float x = -EXP_RANGE + 2 * EXP_RANGE * ((double)i / EXP_POINTS);
+    double error = fabs(fast_expf(x) - exp(x)) / exp(x);
+    if (error > worst) {
+      worst = error;
+      worst_at = x;
+    }
+  }
+  CHECK(worst <= EXP_RELATIVE_ERROR, "fast_expf is %.3g relative off exp at %.9g", worst, worst_at);
+  if (verbose) {
+    printf("fast_expf   %.3g relative, at %.9g\n", worst, worst_at);
+  }
+}
+
+static void check_log(void) {
+  double worst = 0;
+  float worst_at = 0;
+  for (float x = LOG_MINIMUM; x <= LOG_MAXIMUM; x = float_after(x, LOG_FLOAT_STRIDE)) {
+    double error = fabs(fast_logf(x) - log(x));
+    if (error > worst) {
+      worst = error;
+      worst_at = x;
+    }
+  }
+  CHECK(worst <= LOG_ABSOLUTE_ERROR, "fast_logf is %.3g off log at %.9g", worst, worst_at);
+  if (verbose) {
+    printf("fast_logf   %.3g absolute, at %.9g\n", worst, worst_at);
+  }
+}
+
+/* The formulas psychrometrics.c implements, in double precision with libm */
+static void reference_psychrometrics(double temperature, double relative_humidity, double pressure,
+                                     double results[6]) {
+  double enhancement = 1.0016 + 3.15e-6 * pressure - 0.074 / pressure;
+  double exponent = 17.625 * temperature / (243.04 + temperature);
+  double saturation = enhancement * 6.1094 * exp(exponent);
+  double vapour_pressure = relative_humidity / 100 * saturation;
+  double gamma = log(relative_humidity / 100) + exponent;
+  results[0] = vapour_pressure;
+  results[1] = saturation;
+  results[2] = 243.04 * gamma / (17.625 - gamma);
+  results[3] = 216.68 * vapour_pressure / (temperature + 273.15);
+  results[4] = (saturation - vapour_pressure) / 10;
+  results[5] = 621.98 * vapour_pressure / (pressure - vapour_pressure);
+}
+
+static void check_results(void) {
+  static const char *NAMES[6] = {"vapour_pressure", "saturation_vapour_pressure", "dew_point", "absolute_humidity",
+                                 "vapour_pressure_deficit", "mixing_ratio"};
+  double worst[6] = {0};
+  float worst_at[6][3] = {{0}};
+
+  for (int decidegrees = 0; decidegrees <= 500; decidegrees += 2) {
+    for (int half_percent = 10; half_percent <= 200; half_percent++) {
+      for (int pressure = 800; pressure <= 1100; pressure += 10) {
+        float temperature = decidegrees / 10.0f;
+        float relative_humidity = half_percent / 2.0f;
+        struct Psychrometrics result;
+        compute_psychrometrics(temperature, relative_humidity, pressure, &result);
+        float results[6] = {result.vapour_pressure,   result.saturation_vapour_pressure,
+                            result.dew_point,         result.absolute_humidity,
+                            result.vapour_pressure_deficit, result.mixing_ratio};
+        double expected[6];
+        reference_psychrometrics(temperature, relative_humidity, pressure, expected);
+
+        // The standalone helpers have to agree with the bulk calculation
+        CHECK(saturation_vapour_pressure(temperature, pressure) == result.saturation_vapour_pressure,
+              "saturation_vapour_pressure(%g, %d) differs from compute_psychrometrics", temperature, pressure);
+        CHECK(fabs(absolute_humidity(temperature, relative_humidity, pressure) - expected[3]) <= RESULT_ABSOLUTE_ERROR,
+              "absolute_humidity(%g, %g, %d) is off", temperature, relative_humidity, pressure);
+
+        for (int i = 0; i < 6; i++) {
+          double error = fabs(results[i] - expected[i]);
+          if (error > worst[i]) {
+            worst[i] = error;
+            worst_at[i][0] = temperature;
+            worst_at[i][1] = relative_humidity;
+            worst_at[i][2] = pressure;
+          }
+        }
+      }
+    }
+  }
+
+  for (int i = 0; i < 6; i++) {
+    CHECK(worst[i] <= RESULT_ABSOLUTE_ERROR, "%s is %.3g off at %g*C, %g %%RH, %g hPa", NAMES[i], worst[i],
+          worst_at[i][0], worst_at[i][1], worst_at[i][2]);
+    if (verbose) {
+      printf("%-26s %.3g absolute, at %g*C, %g %%RH, %g hPa\n", NAMES[i], worst[i], worst_at[i][0], worst_at[i][1],
+             worst_at[i][2]);
+    }
+  }
+}
+
+/* Hardy (1998) ITS-90 saturation vapour pressure over water, in hPa */
+static double hardy_saturation_vapour_pressure(double temperature) {
+  static const double G[8] = {-2.8365744e3, -6.028076559e3, 1.954263612e1,  -2.737830188e-2,
+                              1.6261698e-5, 7.0229056e-10,  -1.8680009e-13, 2.7150305};
+  double kelvin = temperature + 273.15;
+  double log_pressure = G[7] * log(kelvin);
+  for (int i = 0; i < 7; i++) {
+    log_pressure += G[i] * pow(kelvin, i - 2);
+  }
+  return exp(log_pressure) / 100;
+}
+
+static void check_magnus_fit(void) {
+  double worst = 0;
+  double worst_at = 0;
+  for (int decidegrees = 0; decidegrees <= 500; decidegrees++) {
+    double temperature = decidegrees / 10.0;
+    double magnus = 6.1094 * exp(17.625 * temperature / (243.04 + temperature));
+    double hardy = hardy_saturation_vapour_pressure(temperature);
+    double error = fabs(magnus - hardy) / hardy;
+    if (error > worst) {
+      worst = error;
+      worst_at = temperature;
+    }
+  }
+  CHECK(worst <= MAGNUS_RELATIVE_ERROR, "Magnus is %.3g relative off Hardy at %g*C", worst, worst_at);
+  if (verbose) {
+    printf("Magnus vs Hardy %.3g relative, at %g*C\n", worst, worst_at);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  verbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+  check_exp();
+  check_log();
+  check_results();
+  check_magnus_fit();
+  return host_test_result("test_psychrometrics");
+}
@@ -0,0 +1,210 @@
+/*
+ * Trip latency of the safety supervisor, on a virtual clock.
+ *
+ * Two sensors report every READ_INTERVAL_US, the controller keeps trying to run the heater, and each scenario
+ * breaks one sensor. The supervisor's check runs every CHECK_PERIOD_MS like its task would, at a few phases
+ * against the readings. A fault has to latch, and the heater go off, within one check period of the condition
+ * arising, for stale readings that's within STALE_READING + CHECK_PERIOD_MS of the sensor going quiet.
+ *
+ * The checks run as the supervisor task's loop would, under the heap guard, so a trip that allocates once the
+ * warm-up cycles are over (a float formatted for the first time, say) fails just as it would abort the device.
+ *
+ * Latched state lives in the supervisor's statics, so every run gets a forked child of its own.
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "actuator.h"
+#include "fakes.h"
+#include "heap_guard.h"
+#include "host_test.h"
+#include "safety_supervisor.h"
+#include "sdkconfig.h"
+
+#define CHECK_PERIOD_US (CONFIG_SAFETY_CHECK_PERIOD_MS * 1000LL)
+#define STALE_READING_US (CONFIG_SAFETY_STALE_READING_SECONDS * 1000000LL)
+#define READ_INTERVAL_US 2000000LL
+#define STEP_US 1000LL
+// Long enough for the controller to have settled, and for the stale cases to trip with room to spare
+#define FAULT_AT_US 10000000LL
+#define RUN_US (FAULT_AT_US + STALE_READING_US + 10 * CHECK_PERIOD_US)
+#define SENSORS 2
+
+static const int SENSOR_ADDRESSES[SENSORS] = {0x76, 0x77};
+
+struct Scenario {
+  const char *name;
+  enum SafetyFaultReason expected;
+  // The sensor that misbehaves from FAULT_AT_US on
+  int faulty_sensor;
+  // Returns false when the sensor has nothing to deliver
+  bool (*read)(int sensor, int64_t now, float *temperature);
+};
+
+static float healthy_temperature(int sensor) { return 37.5f + 0.1f * sensor; }
+
+static bool read_healthy(int sensor, int64_t now, float *temperature) {
+  *temperature = healthy_temperature(sensor);
+  return true;
+}
+
+static bool read_over_temperature(int sensor, int64_t now, float *temperature) {
+  *temperature = sensor == 1 && now >= FAULT_AT_US ? 40.0f : healthy_temperature(sensor);
+  return true;
+}
+
+static bool read_disagreement(int sensor, int64_t now, float *temperature) {
+  *temperature = sensor == 0 && now >= FAULT_AT_US ? 35.5f : healthy_temperature(sensor);
+  return true;
+}
+
+static bool read_stale(int sensor, int64_t now, float *temperature) {
+  *temperature = healthy_temperature(sensor);
+  return sensor != 1 || now < FAULT_AT_US;
+}
+
+static bool read_never_reports(int sensor, int64_t now, float *temperature) {
+  *temperature = healthy_temperature(sensor);
+  return sensor != 1;
+}
+
+static const struct Scenario SCENARIOS[] = {
+    {"healthy", SAFETY_FAULT_NONE, -1, read_healthy},
+    {"over_temperature", SAFETY_FAULT_OVER_TEMPERATURE, 1, read_over_temperature},
+    {"sensor_disagreement", SAFETY_FAULT_SENSOR_DISAGREEMENT, 0, read_disagreement},
+    {"stale_readings", SAFETY_FAULT_STALE_READINGS, 1, read_stale},
+    {"never_reports", SAFETY_FAULT_STALE_READINGS, 1, read_never_reports},
+};
+
+// Where the supervisor's checks fall against the readings
+static const long long CHECK_PHASES_US[] = {0, STEP_US, CHECK_PERIOD_US / 2, CHECK_PERIOD_US - STEP_US};
+
+static bool reading_due(int sensor, int64_t now) {
+  // The sensors are read half an interval apart
+  return now % READ_INTERVAL_US == sensor * READ_INTERVAL_US / 2;
+}
+
+static void run(const struct Scenario *scenario, long long phase_us, bool verbose) {
+  fake_set_time(0);
+  initialize_actuators();
+  start_safety_supervisor();
+  heap_guard_watch_current_task();
+
+  bool stale = scenario->expected == SAFETY_FAULT_STALE_READINGS;
+  // For stale readings the condition arises STALE_READING_US after this, supervisor start counts as heard from
+  int64_t last_heard = 0;
+  int64_t condition_at = -1;
+  int64_t latched_at = -1;
+  int64_t next_check = phase_us;
+
+  for (int64_t now = 0; now <= RUN_US && latched_at < 0; now += STEP_US) {
+    fake_set_time(now);
+
+    // Checking before the readings in a step is the worst case, a fault recorded now waits a whole period
+    if (now == next_check) {
+      safety_supervisor_check();
+      heap_guard_end_cycle();
+      next_check += CHECK_PERIOD_US;
+      if (safety_fault_latched()) {
+        latched_at = now;
+        break;
+      }
+    }
+
+    for (int sensor = 0; sensor < SENSORS; sensor++) {
+      float temperature;
+      if (reading_due(sensor, now) && scenario->read(sensor, now, &temperature)) {
+        safety_supervisor_record_temperature(SENSOR_ADDRESSES[sensor], temperature);
+        if (sensor == scenario->faulty_sensor) {
+          last_heard = now;
+          if (!stale && now >= FAULT_AT_US && condition_at < 0) {
+            condition_at = now;
+          }
+        }
+      }
+    }
+
+    // The controller, wanting heat the whole time
+    actuator_set(ACTUATOR_HEATER, true);
+  }
+
+  CHECK(heap_guard_steady_state_allocations() == 0, "%s, phase %lld ms: %u heap allocations after warm-up",
+        scenario->name, phase_us / 1000, heap_guard_steady_state_allocations());
+  if (scenario->expected == SAFETY_FAULT_NONE) {
+    CHECK(latched_at < 0, "%s, phase %lld ms: tripped at %lld ms", scenario->name, phase_us / 1000,
+          (long long)latched_at / 1000);
+    CHECK(actuator_is_on(ACTUATOR_HEATER), "%s, phase %lld ms: heater off", scenario->name, phase_us / 1000);
+    return;
+  }
+
+  if (stale) {
+    condition_at = last_heard + STALE_READING_US;
+  }
+  CHECK(latched_at >= 0, "%s, phase %lld ms: never tripped", scenario->name, phase_us / 1000);
+  if (latched_at < 0) {
+    return;
+  }
+
+  struct SafetyFault fault;
+  CHECK(safety_peek_unreported_fault(&fault), "%s, phase %lld ms: no fault to report", scenario->name,
+        phase_us / 1000);
+  // A report that didn't go out leaves it to be reported again, one that did is the last
+  CHECK(safety_peek_unreported_fault(&fault), "%s, phase %lld ms: fault gone before it was reported", scenario->name,
+        phase_us / 1000);
+  safety_acknowledge_fault_reported();
+  struct SafetyFault again;
+  CHECK(!safety_peek_unreported_fault(&again), "%s, phase %lld ms: fault reported twice", scenario->name,
+        phase_us / 1000);
+  CHECK(fault.reason == scenario->expected, "%s, phase %lld ms: tripped for %s", scenario->name, phase_us / 1000,
+        safety_fault_reason_name(fault.reason));
+  int blamed = scenario->read == read_never_reports ? 0 : SENSOR_ADDRESSES[scenario->faulty_sensor];
+  CHECK(fault.sensor_address == blamed, "%s, phase %lld ms: blamed sensor %X", scenario->name, phase_us / 1000,
+        fault.sensor_address);
+  CHECK(fault.trip_latency_us >= 0 && fault.trip_latency_us <= CHECK_PERIOD_US,
+        "%s, phase %lld ms: supervisor measured %lld us", scenario->name, phase_us / 1000,
+        (long long)fault.trip_latency_us);
+  CHECK(latched_at - condition_at <= CHECK_PERIOD_US, "%s, phase %lld ms: latched %lld us after the fault arose",
+        scenario->name, phase_us / 1000, (long long)(latched_at - condition_at));
+  if (stale) {
+    CHECK(latched_at - last_heard <= STALE_READING_US + CHECK_PERIOD_US,
+          "%s, phase %lld ms: latched %lld us after the sensor went quiet", scenario->name, phase_us / 1000,
+          (long long)(latched_at - last_heard));
+  }
+  CHECK(!actuator_is_on(ACTUATOR_HEATER), "%s, phase %lld ms: heater still on", scenario->name, phase_us / 1000);
+
+  // The controller racing the trip doesn't get the heater back for longer than one check
+  fake_set_time(latched_at + 3600 * 1000000LL);
+  actuator_set(ACTUATOR_HEATER, true);
+  safety_supervisor_check();
+  CHECK(!actuator_is_on(ACTUATOR_HEATER), "%s, phase %lld ms: heater back on after the trip", scenario->name,
+        phase_us / 1000);
+
+  if (verbose) {
+    printf("%-20s phase %4lld ms: latched %4lld ms after the fault arose\n", scenario->name, phase_us / 1000,
+           (long long)((latched_at - condition_at) / 1000));
+  }
+}
+
+int main(int argc, char *argv[]) {
+  bool verbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+
+  for (size_t i = 0; i < sizeof(SCENARIOS) / sizeof(SCENARIOS[0]); i++) {
+    for (size_t j = 0; j < sizeof(CHECK_PHASES_US) / sizeof(CHECK_PHASES_US[0]); j++) {
+      fflush(stdout);
+      pid_t child = fork();
+      if (child == 0) {
+        run(&SCENARIOS[i], CHECK_PHASES_US[j], verbose);
+        fflush(stdout);
+        _exit(host_test_failures > 0);
+      }
+      int status;
+      waitpid(child, &status, 0);
+      CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0, "%s, phase %lld ms failed", SCENARIOS[i].name,
+            CHECK_PHASES_US[j] / 1000);
+    }
+  }
+  return host_test_result("test_safety_supervisor");
+}
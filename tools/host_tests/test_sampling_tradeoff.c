@@ -0,0 +1,135 @@
+/*
+ * The noise and latency figures bme280_helper logs for its sampling configuration, for every combination of
+ * oversampling, IIR filter coefficient and standby time the Kconfig choices allow, in both modes.
+ *
+ * Noise is checked against the filter's impulse response and the time to settle against a step pushed through
+ * the datasheet's IIR filter, rather than against the closed forms sampling_tradeoff.c uses. -v prints the
+ * table for 1x pressure and humidity.
+ */
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "host_test.h"
+#include "sampling_tradeoff.h"
+
+#define COUNT(array) (sizeof(array) / sizeof(array[0]))
+#define READ_INTERVAL_MS 20000
+
+static const int OVERSAMPLINGS[] = {0, 1, 2, 4, 8, 16};
+static const int IIR_FILTER_COEFFICIENTS[] = {0, 2, 4, 8, 16};
+// 0 stands for forced mode
+static const int STANDBY_TIMES_MS[] = {0, 1, 10, 20, 63, 125, 250, 500, 1000};
+
+// The Kconfig help promises these, for coefficients of 0, 2, 4, 8 and 16
+static const int DOCUMENTED_CONVERSIONS_TO_75_PERCENT[] = {1, 2, 5, 11, 22};
+
+/* Variance the filter passes, as the sum of its squared impulse response */
+static double filtered_variance(int coefficient) {
+  if (coefficient < 2) {
+    return 1;
+  }
+  double variance = 0;
+  double weight = 1.0 / coefficient;
+  for (int k = 0; k < 10000; k++) {
+    variance += weight * weight;
+    weight *= 1 - 1.0 / coefficient;
+  }
+  return variance;
+}
+
+/* A unit step through the datasheet's filter, data = (data * (c - 1) + new) / c */
+static int step_conversions_to_75_percent(int coefficient) {
+  if (coefficient < 2) {
+    return 1;
+  }
+  double data = 0;
+  int conversions = 0;
+  while (data < 0.75) {
+    data = (data * (coefficient - 1) + 1) / coefficient;
+    conversions++;
+  }
+  return conversions;
+}
+
+static void check(const struct SamplingSettings *settings, bool print) {
+  struct SamplingTradeoff tradeoff;
+  compute_sampling_tradeoff(settings, &tradeoff);
+
+  double measurement_ms = 1.25 + 2.3 * settings->oversampling_temperature +
+                          (settings->oversampling_pressure > 0 ? 2.3 * settings->oversampling_pressure + 0.575 : 0) +
+                          (settings->oversampling_humidity > 0 ? 2.3 * settings->oversampling_humidity + 0.575 : 0);
+  double period_ms = settings->normal_mode ? measurement_ms + settings->standby_ms : settings->read_interval_ms;
+  int oversampling = settings->oversampling_temperature > 0 ? settings->oversampling_temperature : 1;
+  double noise = sqrt(filtered_variance(settings->iir_filter_coefficient) / oversampling);
+  int conversions = step_conversions_to_75_percent(settings->iir_filter_coefficient);
+
+  char name[96];
+  snprintf(name, sizeof(name), "osrs %d/%d/%d, iir %d, %s %d ms", settings->oversampling_temperature,
+           settings->oversampling_pressure, settings->oversampling_humidity, settings->iir_filter_coefficient,
+           settings->normal_mode ? "standby" : "forced every", settings->normal_mode ? settings->standby_ms
+                                                                                     : settings->read_interval_ms);
+  CHECK(fabs(tradeoff.measurement_ms - measurement_ms) < 1e-3, "%s: measurement %.3f ms, expected %.3f", name,
+        tradeoff.measurement_ms, measurement_ms);
+  CHECK(fabs(tradeoff.conversion_period_ms - period_ms) < 1e-3, "%s: period %.3f ms, expected %.3f", name,
+        tradeoff.conversion_period_ms, period_ms);
+  CHECK(fabs(tradeoff.temperature_noise - noise) < 1e-5 * noise, "%s: noise %.5f, expected %.5f", name,
+        tradeoff.temperature_noise, noise);
+  CHECK(tradeoff.conversions_to_75_percent == conversions, "%s: 75%% after %d conversions, expected %d", name,
+        tradeoff.conversions_to_75_percent, conversions);
+  CHECK(fabs(tradeoff.settle_ms - conversions * period_ms) < 1e-3 * conversions * period_ms,
+        "%s: settles in %.1f ms, expected %.1f", name, tradeoff.settle_ms, conversions * period_ms);
+
+  if (print) {
+    char standby[16] = "forced";
+    if (settings->normal_mode) {
+      snprintf(standby, sizeof(standby), "%d", settings->standby_ms);
+    }
+    printf("%6d %5d %12s %14.1f %10.1f %8.3f %12d %12.2f\n", settings->oversampling_temperature,
+           settings->iir_filter_coefficient, standby, tradeoff.measurement_ms,
+           tradeoff.conversion_period_ms, tradeoff.temperature_noise, tradeoff.conversions_to_75_percent,
+           tradeoff.settle_ms / 1000);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  bool verbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+  if (verbose) {
+    printf("%6s %5s %12s %14s %10s %8s %12s %12s\n", "osrs_t", "iir", "standby ms", "measurement ms",
+           "period ms", "noise", "to 75%", "settle s");
+  }
+
+  for (size_t i = 0; i < COUNT(IIR_FILTER_COEFFICIENTS); i++) {
+    int coefficient = IIR_FILTER_COEFFICIENTS[i];
+    CHECK(step_conversions_to_75_percent(coefficient) == DOCUMENTED_CONVERSIONS_TO_75_PERCENT[i],
+          "iir %d: Kconfig says 75%% after %d conversions, the filter takes %d", coefficient,
+          DOCUMENTED_CONVERSIONS_TO_75_PERCENT[i], step_conversions_to_75_percent(coefficient));
+  }
+
+  int combinations = 0;
+  for (size_t t = 0; t < COUNT(OVERSAMPLINGS); t++) {
+    for (size_t i = 0; i < COUNT(IIR_FILTER_COEFFICIENTS); i++) {
+      for (size_t s = 0; s < COUNT(STANDBY_TIMES_MS); s++) {
+        for (size_t p = 0; p < COUNT(OVERSAMPLINGS); p++) {
+          for (size_t h = 0; h < COUNT(OVERSAMPLINGS); h++) {
+            struct SamplingSettings settings = {.oversampling_temperature = OVERSAMPLINGS[t],
+                                                .oversampling_pressure = OVERSAMPLINGS[p],
+                                                .oversampling_humidity = OVERSAMPLINGS[h],
+                                                .iir_filter_coefficient = IIR_FILTER_COEFFICIENTS[i],
+                                                .normal_mode = STANDBY_TIMES_MS[s] > 0,
+                                                .standby_ms = STANDBY_TIMES_MS[s],
+                                                .read_interval_ms = READ_INTERVAL_MS};
+            check(&settings, verbose && OVERSAMPLINGS[p] == 1 && OVERSAMPLINGS[h] == 1);
+            combinations++;
+          }
+        }
+      }
+    }
+  }
+
+  if (verbose) {
+    printf("%d combinations\n", combinations);
+  }
+  return host_test_result("test_sampling_tradeoff");
+}
@@ -0,0 +1,254 @@
+#include "http_server.h"
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+const size_t MAX_REQUEST_SIZE = 8192;
+const size_t CHUNK_SIZE = 64 * 1024;
+const int RECEIVE_TIMEOUT_SECONDS = 5;
+// Connections are served one at a time, a client that stops reading mustn't hold up everyone behind it
+const int SEND_TIMEOUT_SECONDS = 10;
+
+const char *status_text(int status) {
+  switch (status) {
+    case 200:
+      return "OK";
+    case 400:
+      return "Bad Request";
+    case 404:
+      return "Not Found";
+    case 405:
+      return "Method Not Allowed";
+    default:
+      return "Internal Server Error";
+  }
+}
+
+int hex_value(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+std::string url_decode(const std::string &text) {
+  std::string decoded;
+  for (size_t i = 0; i < text.size(); i++) {
+    if (text[i] == '+') {
+      decoded += ' ';
+    } else if (text[i] == '%' && i + 2 < text.size() && hex_value(text[i + 1]) >= 0 && hex_value(text[i + 2]) >= 0) {
+      decoded += static_cast<char>(hex_value(text[i + 1]) * 16 + hex_value(text[i + 2]));
+      i += 2;
+    } else {
+      decoded += text[i];
+    }
+  }
+  return decoded;
+}
+
+bool parse_request(const std::string &head, HttpRequest &request) {
+  size_t method_end = head.find(' ');
+  size_t target_end = head.find(' ', method_end + 1);
+  if (method_end == std::string::npos || target_end == std::string::npos) {
+    return false;
+  }
+  request.method = head.substr(0, method_end);
+  std::string target = head.substr(method_end + 1, target_end - method_end - 1);
+
+  size_t query_start = target.find('?');
+  request.path = url_decode(target.substr(0, query_start));
+  if (query_start == std::string::npos) {
+    return true;
+  }
+
+  std::string query = target.substr(query_start + 1);
+  size_t position = 0;
+  while (position <= query.size()) {
+    size_t end = query.find('&', position);
+    if (end == std::string::npos) {
+      end = query.size();
+    }
+    std::string pair = query.substr(position, end - position);
+    size_t equals = pair.find('=');
+    if (!pair.empty()) {
+      request.query[url_decode(pair.substr(0, equals))] =
+          equals == std::string::npos ? "" : url_decode(pair.substr(equals + 1));
+    }
+    position = end + 1;
+  }
+  return true;
+}
+
+}  // namespace
+
+std::string HttpRequest::parameter(const std::string &name, const std::string &fallback) const {
+  auto found = query.find(name);
+  return found == query.end() ? fallback : found->second;
+}
+
+HttpResponse::~HttpResponse() { finish(); }
+
+void HttpResponse::add_header(const std::string &name, const std::string &value) {
+  headers_ += name + ": " + value + "\r\n";
+}
+
+void HttpResponse::start(int status, const std::string &content_type) {
+  if (started_) {
+    return;
+  }
+  started_ = true;
+  char status_line[64];
+  std::snprintf(status_line, sizeof(status_line), "HTTP/1.1 %d %s\r\n", status, status_text(status));
+  std::string head = status_line;
+  head += "Content-Type: " + content_type + "\r\nTransfer-Encoding: chunked\r\nConnection: close\r\n";
+  head += "Access-Control-Allow-Origin: *\r\n" + headers_ + "\r\n";
+  send_all(head.data(), head.size());
+}
+
+void HttpResponse::write(const char *data, size_t length) {
+  if (failed_) {
+    // Nobody's going to read the rest of the body
+    return;
+  }
+  buffer_.append(data, length);
+  if (buffer_.size() >= CHUNK_SIZE) {
+    flush();
+  }
+}
+
+void HttpResponse::flush() {
+  if (buffer_.empty()) {
+    return;
+  }
+  char size_line[32];
+  int size_length = std::snprintf(size_line, sizeof(size_line), "%zx\r\n", buffer_.size());
+  buffer_ += "\r\n";
+  send_all(size_line, size_length) && send_all(buffer_.data(), buffer_.size());
+  buffer_.clear();
+}
+
+void HttpResponse::finish() {
+  if (finished_) {
+    return;
+  }
+  start(200, "text/plain");
+  flush();
+  send_all("0\r\n\r\n", 5);
+  finished_ = true;
+}
+
+void HttpResponse::send(int status, const std::string &body) {
+  start(status, "text/plain");
+  write(body.data(), body.size());
+  finish();
+}
+
+void HttpResponse::fail(const std::string &message) {
+  if (!started_) {
+    send(500, message);
+    return;
+  }
+  abandon();
+}
+
+void HttpResponse::abandon() {
+  buffer_.clear();
+  finished_ = true;
+  failed_ = true;
+  // The close after the handler resets the connection rather than ending it cleanly, so even a client that
+  // doesn't look for the last chunk sees an error
+  struct linger reset = {1, 0};
+  setsockopt(socket_, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+}
+
+bool HttpResponse::send_all(const char *data, size_t length) {
+  if (failed_ || length == 0) {
+    return !failed_;
+  }
+  ssize_t sent;
+  do {
+    sent = ::send(socket_, data, length, MSG_NOSIGNAL);
+  } while (sent < 0 && errno == EINTR);
+  // A blocking send only comes back short when SO_SNDTIMEO ran out partway, and with -1 (EAGAIN) when it ran out
+  // before anything went. Either way the client has stopped reading, or gone, and there's nobody left to tell.
+  if (sent < 0 || static_cast<size_t>(sent) < length) {
+    abandon();
+  }
+  return !failed_;
+}
+
+void HttpServer::route(const std::string &path, Handler handler) { routes_[path] = std::move(handler); }
+
+void HttpServer::handle_connection(int socket) {
+  struct timeval timeout = {RECEIVE_TIMEOUT_SECONDS, 0};
+  setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  struct timeval send_timeout = {SEND_TIMEOUT_SECONDS, 0};
+  setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+
+  std::string received;
+  char buffer[2048];
+  while (received.find("\r\n\r\n") == std::string::npos && received.size() < MAX_REQUEST_SIZE) {
+    ssize_t length = recv(socket, buffer, sizeof(buffer), 0);
+    if (length <= 0) {
+      return;
+    }
+    received.append(buffer, length);
+  }
+
+  HttpResponse response(socket);
+  HttpRequest request;
+  if (!parse_request(received.substr(0, received.find("\r\n")), request)) {
+    response.send(400, "Malformed request\n");
+    return;
+  }
+  if (request.method != "GET") {
+    response.send(405, "Only GET is supported\n");
+    return;
+  }
+  auto route = routes_.find(request.path);
+  if (route == routes_.end()) {
+    response.send(404, "No such path\n");
+    return;
+  }
+  route->second(request, response);
+}
+
+void HttpServer::serve(uint16_t port) {
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  int reuse = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+  struct sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(port);
+  if (bind(listener, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) != 0 ||
+      listen(listener, 16) != 0) {
+    std::perror("Can't listen");
+    close(listener);
+    return;
+  }
+
+  while (true) {
+    int client = accept(listener, nullptr, nullptr);
+    if (client < 0) {
+      continue;
+    }
+    handle_connection(client);
+    close(client);
+  }
+}
@@ -0,0 +1,69 @@
+#ifndef http_server_h
+#define http_server_h
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+
+#include "series.h"
+
+struct HttpRequest {
+  std::string method;
+  std::string path;
+  std::map<std::string, std::string> query;
+
+  // The query parameter, or fallback if it wasn't given
+  std::string parameter(const std::string &name, const std::string &fallback = "") const;
+};
+
+/**
+ * A response sent with chunked transfer encoding, so a body can be written while it's still being encoded
+ */
+class HttpResponse : public Sink {
+ public:
+  explicit HttpResponse(int socket) : socket_(socket) {}
+  ~HttpResponse() override;
+
+  void add_header(const std::string &name, const std::string &value);
+  void start(int status, const std::string &content_type);
+  void write(const char *data, size_t length) override;
+  void finish();
+  // All of the above for a short text body
+  void send(int status, const std::string &body);
+  // A 500 with the message if nothing has gone out yet. Once the body has started it's too late for a status,
+  // so nothing more is written and the connection is reset.
+  void fail(const std::string &message);
+
+ private:
+  void flush();
+  bool send_all(const char *data, size_t length);
+  // Nothing more goes out, and the connection is reset when it's closed
+  void abandon();
+
+  int socket_;
+  std::string headers_;
+  std::string buffer_;
+  bool started_ = false;
+  bool finished_ = false;
+  bool failed_ = false;
+};
+
+/**
+ * Just enough HTTP/1.1 for dashboards to GET from: one request per connection, handled one at a time.
+ */
+class HttpServer {
+ public:
+  using Handler = std::function<void(const HttpRequest &, HttpResponse &)>;
+
+  void route(const std::string &path, Handler handler);
+  // Only returns if the port can't be listened on
+  void serve(uint16_t port);
+
+ private:
+  void handle_connection(int socket);
+
+  std::map<std::string, Handler> routes_;
+};
+
+#endif
@@ -0,0 +1,303 @@
+/*
+ * Compares what a dashboard pays for 21 days of readings, raw and through the query service.
+ *
+ *   query_benchmark synthetic [-n points]
+ *       LTTB time and payload sizes for a generated 21 day, two sensor trace, no database needed. points is
+ *       per sensor, as it is for the service.
+ *   query_benchmark live -m <mac> [-d conninfo] [-s host:port] [-t metric] [-n points] [-r repeats]
+ *       latency and payload size of the raw rows straight from Postgres, against the running service
+ *       (cold, then cached) in JSON and binary
+ *
+ * Build with `make` in this directory.
+ */
+#include <libpq-fe.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "series.h"
+
+namespace {
+
+const double WINDOW_SECONDS = 21 * 86400;
+const double READ_INTERVAL_SECONDS = 10;
+const int SENSORS = 2;
+const size_t DEFAULT_POINTS = 1000;
+const int DEFAULT_REPEATS = 20;
+
+struct Measurement {
+  std::vector<double> latencies_ms;
+  size_t payload_bytes = 0;
+  size_t points = 0;
+};
+
+double now_ms() {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+double percentile(std::vector<double> values, double fraction) {
+  if (values.empty()) {
+    return 0;
+  }
+  std::sort(values.begin(), values.end());
+  return values[static_cast<size_t>(fraction * (values.size() - 1) + 0.5)];
+}
+
+void print_row(const char *name, const Measurement &measurement) {
+  std::printf("%-28s %10zu %12zu %10.2f %10.2f\n", name, measurement.points, measurement.payload_bytes,
+              percentile(measurement.latencies_ms, 0.5), percentile(measurement.latencies_ms, 0.95));
+}
+
+void print_header() {
+  std::printf("%-28s %10s %12s %10s %10s\n", "", "points", "bytes", "p50 ms", "p95 ms");
+}
+
+Measurement measure(int repeats, const std::function<void(Measurement &)> &run) {
+  Measurement measurement;
+  for (int i = 0; i < repeats; i++) {
+    double started = now_ms();
+    run(measurement);
+    measurement.latencies_ms.push_back(now_ms() - started);
+  }
+  return measurement;
+}
+
+// An incubator holding 37.5 with the heater cycling every ten minutes or so, plus sensor noise
+std::vector<Series> synthetic_trace() {
+  std::mt19937 random(1);
+  std::normal_distribution<double> noise(0, 0.02);
+  std::vector<Series> series = {{"76", {}}, {"77", {}}};
+  for (double time = 0; time < WINDOW_SECONDS; time += READ_INTERVAL_SECONDS) {
+    for (int sensor = 0; sensor < SENSORS; sensor++) {
+      double value = 37.5 + 0.3 * std::sin(time / 600 * 2 * M_PI) + 0.1 * sensor + noise(random);
+      series[sensor].points.push_back(Point{1600000000 + time + sensor * 0.5, value});
+    }
+  }
+  return series;
+}
+
+int synthetic(size_t points_wanted) {
+  std::vector<Series> trace = synthetic_trace();
+  std::vector<Series> sampled;
+
+  print_header();
+  print_row("raw json", measure(1, [&](Measurement &m) {
+              StringSink sink;
+              encode_json(trace, sink);
+              m.payload_bytes = sink.buffer.size();
+              m.points = point_count(trace);
+            }));
+  print_row("lttb", measure(DEFAULT_REPEATS, [&](Measurement &m) {
+              sampled = lttb(trace, points_wanted);
+              m.points = point_count(sampled);
+            }));
+  print_row("lttb json", measure(DEFAULT_REPEATS, [&](Measurement &m) {
+              StringSink sink;
+              encode_json(lttb(trace, points_wanted), sink);
+              m.payload_bytes = sink.buffer.size();
+              m.points = point_count(sampled);
+            }));
+  print_row("lttb binary", measure(DEFAULT_REPEATS, [&](Measurement &m) {
+              StringSink sink;
+              encode_binary(lttb(trace, points_wanted), sink);
+              m.payload_bytes = sink.buffer.size();
+              m.points = point_count(sampled);
+            }));
+  return 0;
+}
+
+/* A GET over a fresh connection, the way a dashboard would make it. Returns the decoded body size, or -1. */
+long http_get(const std::string &host, const std::string &port, const std::string &target, long *points) {
+  struct addrinfo hints = {};
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo *address;
+  if (getaddrinfo(host.c_str(), port.c_str(), &hints, &address) != 0) {
+    return -1;
+  }
+  int connection = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+  bool connected = connection >= 0 && connect(connection, address->ai_addr, address->ai_addrlen) == 0;
+  freeaddrinfo(address);
+  if (!connected) {
+    if (connection >= 0) {
+      close(connection);
+    }
+    return -1;
+  }
+
+  std::string request = "GET " + target + " HTTP/1.1\r\nHost: " + host + "\r\nConnection: close\r\n\r\n";
+  send(connection, request.data(), request.size(), MSG_NOSIGNAL);
+
+  std::string response;
+  char buffer[65536];
+  ssize_t length;
+  while ((length = recv(connection, buffer, sizeof(buffer), 0)) > 0) {
+    response.append(buffer, length);
+  }
+  close(connection);
+
+  size_t body = response.find("\r\n\r\n");
+  if (body == std::string::npos || response.compare(0, 12, "HTTP/1.1 200") != 0) {
+    return -1;
+  }
+  size_t header = response.find("X-Points: ");
+  if (header != std::string::npos && header < body) {
+    *points = std::atol(response.c_str() + header + 10);
+  }
+
+  // Undo the chunking, only the payload counts
+  long total = 0;
+  size_t position = body + 4;
+  while (position < response.size()) {
+    long chunk = std::strtol(response.c_str() + position, nullptr, 16);
+    if (chunk <= 0) {
+      break;
+    }
+    total += chunk;
+    position = response.find("\r\n", position) + 2 + chunk + 2;
+  }
+  return total;
+}
+
+int live(const std::string &mac, const std::string &conninfo, const std::string &server, const std::string &metric,
+         size_t points_wanted, int repeats) {
+  std::string host = server.substr(0, server.find(':'));
+  std::string port = server.find(':') == std::string::npos ? "8080" : server.substr(server.find(':') + 1);
+
+  PGconn *connection = PQconnectdb(conninfo.c_str());
+  if (PQstatus(connection) != CONNECTION_OK) {
+    std::fprintf(stderr, "Can't connect to the database: %s", PQerrorMessage(connection));
+    PQfinish(connection);
+    return 1;
+  }
+
+  const char *table = metric == "temperature" ? "temperature" : "humidity";
+  std::string sql = std::string("SELECT * FROM ") + table +
+                    " WHERE mac = $1 AND client_time >= (SELECT max(client_time) FROM " + table +
+                    " WHERE mac = $1) - interval '21 days' ORDER BY client_time";
+  double to = 0;
+  bool failed = false;
+
+  print_header();
+  print_row("postgres raw rows", measure(repeats, [&](Measurement &m) {
+              const char *values[] = {mac.c_str()};
+              PGresult *result = PQexecParams(connection, sql.c_str(), 1, nullptr, values, nullptr, nullptr, 0);
+              if (PQresultStatus(result) != PGRES_TUPLES_OK) {
+                std::fprintf(stderr, "Query failed: %s", PQresultErrorMessage(result));
+                failed = true;
+              }
+              // Text the client has to take in, before any per row framing
+              m.payload_bytes = 0;
+              for (int row = 0; row < PQntuples(result); row++) {
+                for (int column = 0; column < PQnfields(result); column++) {
+                  m.payload_bytes += PQgetlength(result, row, column);
+                }
+              }
+              m.points = PQntuples(result);
+              PQclear(result);
+            }));
+
+  // The service is asked for the same window the raw query covers
+  PGresult *latest = PQexecParams(connection,
+                                  (std::string("SELECT extract(epoch FROM max(client_time))::float8 FROM ") + table +
+                                   " WHERE mac = $1").c_str(),
+                                  1, nullptr, std::vector<const char *>{mac.c_str()}.data(), nullptr, nullptr, 0);
+  if (PQresultStatus(latest) == PGRES_TUPLES_OK && !PQgetisnull(latest, 0, 0)) {
+    to = std::atof(PQgetvalue(latest, 0, 0)) + 1;
+  }
+  PQclear(latest);
+  PQfinish(connection);
+  if (failed) {
+    return 1;
+  }
+
+  auto service = [&](const char *name, const std::string &format, size_t points, int times) {
+    char target[512];
+    std::snprintf(target, sizeof(target), "/series?mac=%s&metric=%s&from=%.0f&to=%.0f&points=%zu&format=%s",
+                  mac.c_str(), metric.c_str(), to - WINDOW_SECONDS, to, points, format.c_str());
+    print_row(name, measure(times, [&](Measurement &m) {
+                long count = 0;
+                long bytes = http_get(host, port, target, &count);
+                if (bytes < 0) {
+                  failed = true;
+                }
+                m.payload_bytes = bytes < 0 ? 0 : bytes;
+                m.points = count;
+              }));
+  };
+
+  service("service raw json, cold", "json", 0, 1);
+  service("service raw json, cached", "json", 0, repeats);
+  service("service lttb json, cached", "json", points_wanted, repeats);
+  service("service lttb binary, cached", "binary", points_wanted, repeats);
+  if (failed) {
+    std::fprintf(stderr, "Some requests to %s failed, is query_service running?\n", server.c_str());
+    return 1;
+  }
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    std::fprintf(stderr,
+                 "Usage: %s synthetic [-n points]\n"
+                 "       %s live -m <mac> [-d conninfo] [-s host:port] [-t metric] [-n points] [-r repeats]\n",
+                 argv[0], argv[0]);
+    return 2;
+  }
+  std::string mode = argv[1];
+  std::string mac;
+  std::string conninfo = "dbname=incubator";
+  std::string server = "localhost:8080";
+  std::string metric = "temperature";
+  size_t points = DEFAULT_POINTS;
+  int repeats = DEFAULT_REPEATS;
+
+  optind = 2;
+  int option;
+  while ((option = getopt(argc, argv, "m:d:s:t:n:r:")) != -1) {
+    switch (option) {
+      case 'm':
+        mac = optarg;
+        break;
+      case 'd':
+        conninfo = optarg;
+        break;
+      case 's':
+        server = optarg;
+        break;
+      case 't':
+        metric = optarg;
+        break;
+      case 'n':
+        points = static_cast<size_t>(std::atol(optarg));
+        break;
+      case 'r':
+        repeats = std::max(1, std::atoi(optarg));
+        break;
+      default:
+        return 2;
+    }
+  }
+
+  if (mode == "synthetic") {
+    return synthetic(points);
+  }
+  if (mode == "live" && !mac.empty()) {
+    return live(mac, conninfo, server, metric, points, repeats);
+  }
+  std::fprintf(stderr, "Unknown mode %s, or live without -m <mac>\n", mode.c_str());
+  return 2;
+}
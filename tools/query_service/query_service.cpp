@@ -0,0 +1,160 @@
+/*
+ * Serves readings to dashboards, downsampled to however many points they can draw.
+ *
+ *   query_service [-p port] [-d conninfo] [-c cache_entries] [-w cache_window_days]
+ *
+ *   GET /series?mac=<mac>&metric=temperature&from=<s>&to=<s>&points=1000&format=json
+ *
+ * metric is temperature, humidity, dew_point, absolute_humidity, vapour_pressure_deficit or pressure. There's a
+ * series for each sensor, each downsampled to points on its own, and sensor=<address> picks out one. from and to
+ * are seconds since the epoch, defaulting to the last 21 days. points=0 returns every reading, and at most
+ * MAX_POINTS can be asked for. format=binary returns packed series (see encode_binary) instead of JSON.
+ * X-Raw-Points, X-Points and X-Cache headers say what the response was made from, counted over every series.
+ *
+ * conninfo is a libpq connection string, the usual PG* environment variables fill in anything it leaves out.
+ *
+ * Build with `make` in this directory.
+ */
+#include <unistd.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <exception>
+#include <string>
+
+#include "http_server.h"
+#include "reading_store.h"
+#include "series.h"
+#include "window_cache.h"
+
+namespace {
+
+const uint16_t DEFAULT_PORT = 8080;
+const char *DEFAULT_CONNINFO = "dbname=incubator";
+const size_t DEFAULT_CACHE_ENTRIES = 16;
+const double DEFAULT_WINDOW_DAYS = 21;
+const size_t DEFAULT_POINTS = 1000;
+// Per sensor, well past what any screen can draw. Beyond it points=0 is the honest request.
+const size_t MAX_POINTS = 100000;
+const double SECONDS_PER_DAY = 86400;
+
+bool parse_number(const std::string &text, double *value) {
+  char *end;
+  *value = std::strtod(text.c_str(), &end);
+  // strtod takes nan and inf, which would make nonsense of the window and the bucket count
+  return !text.empty() && *end == '\0' && std::isfinite(*value);
+}
+
+void handle_series(const HttpRequest &request, HttpResponse &response, WindowCache &cache) {
+  auto started = std::chrono::steady_clock::now();
+
+  SeriesKey key{request.parameter("mac"), request.parameter("metric", "temperature"), request.parameter("sensor")};
+  if (key.mac.empty()) {
+    response.send(400, "mac is required\n");
+    return;
+  }
+  if (!ReadingStore::is_known_metric(key.metric)) {
+    response.send(400, "Unknown metric " + key.metric + "\n");
+    return;
+  }
+
+  double to = static_cast<double>(std::time(nullptr));
+  double points_wanted = DEFAULT_POINTS;
+  if ((request.query.count("to") && !parse_number(request.parameter("to"), &to)) ||
+      (request.query.count("points") && !parse_number(request.parameter("points"), &points_wanted)) ||
+      points_wanted < 0 || points_wanted > MAX_POINTS) {
+    response.send(400, "to must be a number and points 0 to " + std::to_string(MAX_POINTS) + "\n");
+    return;
+  }
+  double from = to - DEFAULT_WINDOW_DAYS * SECONDS_PER_DAY;
+  if (request.query.count("from") && !parse_number(request.parameter("from"), &from)) {
+    response.send(400, "from must be a number\n");
+    return;
+  }
+  std::string format = request.parameter("format", "json");
+  if (format != "json" && format != "binary") {
+    response.send(400, "format is json or binary\n");
+    return;
+  }
+
+  bool hit = false;
+  std::vector<Series> series = cache.get(key, from, to, &hit);
+  size_t raw_count = point_count(series);
+  if (points_wanted > 0) {
+    series = lttb(series, static_cast<size_t>(points_wanted));
+  }
+  size_t count = point_count(series);
+
+  response.add_header("X-Raw-Points", std::to_string(raw_count));
+  response.add_header("X-Points", std::to_string(count));
+  response.add_header("X-Cache", hit ? "hit" : "miss");
+  if (format == "binary") {
+    response.start(200, "application/octet-stream");
+    encode_binary(series, response);
+  } else {
+    response.start(200, "application/json");
+    encode_json(series, response);
+  }
+  response.finish();
+
+  double elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+  std::printf("%s %s: %zu of %zu points in %zu series (%s) in %.1f ms\n", key.to_string().c_str(), format.c_str(),
+              count, raw_count, series.size(), hit ? "cached" : "queried", elapsed_ms);
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  uint16_t port = DEFAULT_PORT;
+  std::string conninfo = DEFAULT_CONNINFO;
+  size_t cache_entries = DEFAULT_CACHE_ENTRIES;
+  double window_days = DEFAULT_WINDOW_DAYS;
+
+  int option;
+  while ((option = getopt(argc, argv, "p:d:c:w:")) != -1) {
+    switch (option) {
+      case 'p':
+        port = static_cast<uint16_t>(std::atoi(optarg));
+        break;
+      case 'd':
+        conninfo = optarg;
+        break;
+      case 'c':
+        cache_entries = static_cast<size_t>(std::atol(optarg));
+        break;
+      case 'w':
+        window_days = std::atof(optarg);
+        break;
+      default:
+        std::fprintf(stderr, "Usage: %s [-p port] [-d conninfo] [-c cache_entries] [-w cache_window_days]\n",
+                     argv[0]);
+        return 2;
+    }
+  }
+  setvbuf(stdout, nullptr, _IOLBF, 0);
+
+  try {
+    ReadingStore store(conninfo);
+    WindowCache cache(store, cache_entries, window_days * SECONDS_PER_DAY);
+
+    HttpServer server;
+    server.route("/health", [](const HttpRequest &, HttpResponse &response) { response.send(200, "ok\n"); });
+    server.route("/series", [&cache](const HttpRequest &request, HttpResponse &response) {
+      try {
+        handle_series(request, response, cache);
+      } catch (const std::exception &error) {
+        std::fprintf(stderr, "%s\n", error.what());
+        response.fail(std::string(error.what()) + "\n");
+      }
+    });
+
+    std::printf("Serving on port %u\n", port);
+    server.serve(port);
+  } catch (const std::exception &error) {
+    std::fprintf(stderr, "%s\n", error.what());
+  }
+  return 1;
+}
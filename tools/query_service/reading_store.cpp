@@ -0,0 +1,115 @@
+#include "reading_store.h"
+
+#include <endian.h>
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+struct Metric {
+  const char *name;
+  const char *table;
+  const char *column;
+};
+
+// Queries are only ever built from this table, never from request text
+const Metric METRICS[] = {
+    {"temperature", "temperature", "temperature"},
+    {"humidity", "humidity", "humidity"},
+    {"dew_point", "humidity", "dew_point"},
+    {"absolute_humidity", "humidity", "absolute_humidity"},
+    {"vapour_pressure_deficit", "humidity", "vapour_pressure_deficit"},
+    {"pressure", "humidity", "pressure"},
+};
+
+const Metric *find_metric(const std::string &name) {
+  for (const Metric &metric : METRICS) {
+    if (name == metric.name) {
+      return &metric;
+    }
+  }
+  return nullptr;
+}
+
+// Results come back in binary, float8 is a big-endian IEEE 754 double
+double read_float8(const char *data) {
+  uint64_t bits;
+  std::memcpy(&bits, data, sizeof(bits));
+  bits = be64toh(bits);
+  double value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+}  // namespace
+
+ReadingStore::ReadingStore(const std::string &conninfo) : conninfo_(conninfo) { ensure_connected(); }
+
+ReadingStore::~ReadingStore() {
+  if (connection_ != nullptr) {
+    PQfinish(connection_);
+  }
+}
+
+bool ReadingStore::is_known_metric(const std::string &metric) { return find_metric(metric) != nullptr; }
+
+void ReadingStore::ensure_connected() {
+  if (connection_ != nullptr && PQstatus(connection_) == CONNECTION_OK) {
+    return;
+  }
+  if (connection_ != nullptr) {
+    PQreset(connection_);
+  } else {
+    connection_ = PQconnectdb(conninfo_.c_str());
+  }
+  if (PQstatus(connection_) != CONNECTION_OK) {
+    throw std::runtime_error(std::string("Can't connect to the database: ") + PQerrorMessage(connection_));
+  }
+}
+
+std::vector<Series> ReadingStore::fetch(const SeriesKey &key, double from, double to) {
+  const Metric *metric = find_metric(key.metric);
+  if (metric == nullptr) {
+    throw std::runtime_error("Unknown metric " + key.metric);
+  }
+  ensure_connected();
+
+  // client_time is the device's wall clock with no zone, it's treated as UTC throughout
+  std::string sql = std::string("SELECT extract(epoch FROM client_time)::float8, ") + metric->column +
+                    "::float8, coalesce(sensor_address, '') AS sensor FROM " + metric->table +
+                    " WHERE mac = $1 AND client_time >= to_timestamp($2) AT TIME ZONE 'UTC'"
+                    " AND client_time < to_timestamp($3) AT TIME ZONE 'UTC' AND " +
+                    metric->column + " IS NOT NULL";
+  if (!key.sensor_address.empty()) {
+    sql += " AND sensor_address = $4";
+  }
+  sql += " ORDER BY sensor COLLATE \"C\", client_time";
+
+  std::string from_text = std::to_string(from);
+  std::string to_text = std::to_string(to);
+  const char *values[] = {key.mac.c_str(), from_text.c_str(), to_text.c_str(), key.sensor_address.c_str()};
+  int parameter_count = key.sensor_address.empty() ? 3 : 4;
+
+  PGresult *result = PQexecParams(connection_, sql.c_str(), parameter_count, nullptr, values, nullptr, nullptr, 1);
+  if (PQresultStatus(result) != PGRES_TUPLES_OK) {
+    std::string message = PQresultErrorMessage(result);
+    PQclear(result);
+    throw std::runtime_error("Query failed: " + message);
+  }
+
+  int rows = PQntuples(result);
+  std::vector<Series> series;
+  for (int row = 0; row < rows; row++) {
+    // varchar comes back as its bytes in binary results too
+    std::string sensor_address(PQgetvalue(result, row, 2), PQgetlength(result, row, 2));
+    if (series.empty() || series.back().sensor_address != sensor_address) {
+      series.push_back(Series{sensor_address, {}});
+    }
+    series.back().points.push_back(
+        Point{read_float8(PQgetvalue(result, row, 0)), read_float8(PQgetvalue(result, row, 1))});
+  }
+  PQclear(result);
+  return series;
+}
@@ -0,0 +1,43 @@
+#ifndef reading_store_h
+#define reading_store_h
+
+#include <libpq-fe.h>
+
+#include <string>
+#include <vector>
+
+#include "series.h"
+
+struct SeriesKey {
+  std::string mac;
+  std::string metric;
+  // Empty for readings from every sensor
+  std::string sensor_address;
+
+  std::string to_string() const { return mac + "/" + metric + "/" + sensor_address; }
+};
+
+/**
+ * The readings tables from provision.sql. Not thread safe, one connection is used for every query.
+ * Failures throw std::runtime_error.
+ */
+class ReadingStore {
+ public:
+  explicit ReadingStore(const std::string &conninfo);
+  ~ReadingStore();
+  ReadingStore(const ReadingStore &) = delete;
+  ReadingStore &operator=(const ReadingStore &) = delete;
+
+  static bool is_known_metric(const std::string &metric);
+
+  // Readings in [from, to) seconds, a series per sensor in byte order of their addresses
+  std::vector<Series> fetch(const SeriesKey &key, double from, double to);
+
+ private:
+  void ensure_connected();
+
+  std::string conninfo_;
+  PGconn *connection_ = nullptr;
+};
+
+#endif
@@ -0,0 +1,154 @@
+#include "series.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+std::vector<Point> lttb(const std::vector<Point> &points, size_t threshold) {
+  size_t count = points.size();
+  if (threshold >= count || threshold < 3) {
+    return points;
+  }
+
+  std::vector<Point> sampled;
+  sampled.reserve(threshold);
+  sampled.push_back(points[0]);
+
+  // The first and last points are always kept, everything between is split into threshold - 2 buckets
+  double bucket_size = static_cast<double>(count - 2) / (threshold - 2);
+  size_t previous = 0;
+
+  for (size_t bucket = 0; bucket < threshold - 2; bucket++) {
+    size_t start = static_cast<size_t>(std::floor(bucket * bucket_size)) + 1;
+    size_t end = static_cast<size_t>(std::floor((bucket + 1) * bucket_size)) + 1;
+
+    // The third corner is the average of the next bucket, or the last point for the final bucket
+    size_t next_start = end;
+    size_t next_end = std::min(static_cast<size_t>(std::floor((bucket + 2) * bucket_size)) + 1, count);
+    if (next_start >= next_end) {
+      next_start = count - 1;
+      next_end = count;
+    }
+    double average_time = 0;
+    double average_value = 0;
+    for (size_t i = next_start; i < next_end; i++) {
+      average_time += points[i].time;
+      average_value += points[i].value;
+    }
+    average_time /= next_end - next_start;
+    average_value /= next_end - next_start;
+
+    const Point &a = points[previous];
+    double largest_area = -1;
+    size_t chosen = start;
+    for (size_t i = start; i < end; i++) {
+      // Twice the triangle's area, which ranks them just the same
+      double area = std::fabs((a.time - average_time) * (points[i].value - a.value) -
+                              (a.time - points[i].time) * (average_value - a.value));
+      if (area > largest_area) {
+        largest_area = area;
+        chosen = i;
+      }
+    }
+    sampled.push_back(points[chosen]);
+    previous = chosen;
+  }
+
+  sampled.push_back(points[count - 1]);
+  return sampled;
+}
+
+std::vector<Series> lttb(const std::vector<Series> &series, size_t threshold) {
+  std::vector<Series> sampled;
+  sampled.reserve(series.size());
+  for (const Series &one : series) {
+    sampled.push_back(Series{one.sensor_address, lttb(one.points, threshold)});
+  }
+  return sampled;
+}
+
+size_t point_count(const std::vector<Series> &series) {
+  size_t count = 0;
+  for (const Series &one : series) {
+    count += one.points.size();
+  }
+  return count;
+}
+
+static void encode_json_points(const std::vector<Point> &points, Sink &sink) {
+  char buffer[16384];
+  size_t length = 0;
+  for (size_t i = 0; i < points.size(); i++) {
+    if (length > sizeof(buffer) - 64) {
+      sink.write(buffer, length);
+      length = 0;
+    }
+    length += std::snprintf(buffer + length, sizeof(buffer) - length, "%s[%lld,%.6g]", i > 0 ? "," : "",
+                            static_cast<long long>(std::llround(points[i].time * 1000)), points[i].value);
+  }
+  sink.write(buffer, length);
+}
+
+void encode_json(const std::vector<Series> &series, Sink &sink) {
+  std::string text = "{\"series\":[";
+  for (size_t i = 0; i < series.size(); i++) {
+    text += i > 0 ? ",{\"sensor\":\"" : "{\"sensor\":\"";
+    // Addresses are hex the device wrote, anything that would need escaping is dropped rather than escaped
+    for (char c : series[i].sensor_address) {
+      if (c != '"' && c != '\\' && static_cast<unsigned char>(c) >= 0x20) {
+        text += c;
+      }
+    }
+    text += "\",\"points\":[";
+    sink.write(text.data(), text.size());
+    encode_json_points(series[i].points, sink);
+    text = "]}";
+  }
+  text += "]}";
+  sink.write(text.data(), text.size());
+}
+
+static void put_le(char *out, uint64_t value, size_t bytes) {
+  for (size_t i = 0; i < bytes; i++) {
+    out[i] = static_cast<char>((value >> (8 * i)) & 0xFF);
+  }
+}
+
+static void encode_binary_points(const std::vector<Point> &points, Sink &sink) {
+  char count[4];
+  put_le(count, points.size(), 4);
+  sink.write(count, 4);
+
+  char buffer[12 * 1024];
+  size_t length = 0;
+  for (const Point &point : points) {
+    if (length == sizeof(buffer)) {
+      sink.write(buffer, length);
+      length = 0;
+    }
+    uint64_t time_bits;
+    std::memcpy(&time_bits, &point.time, sizeof(time_bits));
+    float value = static_cast<float>(point.value);
+    uint32_t value_bits;
+    std::memcpy(&value_bits, &value, sizeof(value_bits));
+    put_le(buffer + length, time_bits, 8);
+    put_le(buffer + length + 8, value_bits, 4);
+    length += 12;
+  }
+  sink.write(buffer, length);
+}
+
+void encode_binary(const std::vector<Series> &series, Sink &sink) {
+  char count[4];
+  put_le(count, series.size(), 4);
+  sink.write(count, 4);
+
+  for (const Series &one : series) {
+    char length = static_cast<char>(std::min<size_t>(one.sensor_address.size(), 255));
+    sink.write(&length, 1);
+    sink.write(one.sensor_address.data(), static_cast<unsigned char>(length));
+    encode_binary_points(one.points, sink);
+  }
+}
@@ -0,0 +1,54 @@
+#ifndef series_h
+#define series_h
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+struct Point {
+  double time;  // Seconds since the epoch, of the device's wall clock
+  double value;
+};
+
+// One sensor's readings, oldest first
+struct Series {
+  std::string sensor_address;
+  std::vector<Point> points;
+};
+
+// Where an encoded response goes, a socket for the service and a string for the benchmark
+class Sink {
+ public:
+  virtual ~Sink() = default;
+  virtual void write(const char *data, size_t length) = 0;
+};
+
+class StringSink : public Sink {
+ public:
+  void write(const char *data, size_t length) override { buffer.append(data, length); }
+  std::string buffer;
+};
+
+/**
+ * Largest-Triangle-Three-Buckets (Steinarsson, 2013). Keeps the first and last points and, from each of
+ * threshold - 2 equal buckets in between, the point making the largest triangle with the point kept from the
+ * previous bucket and the average of the next. Peaks and troughs survive, which averaging would flatten.
+ * Returns the input unchanged if it already fits.
+ */
+std::vector<Point> lttb(const std::vector<Point> &points, size_t threshold);
+
+// Each sensor downsampled on its own, to threshold points apiece. Sensors interleaved in one series would
+// have LTTB drawing triangles between readings that were never on the same line.
+std::vector<Series> lttb(const std::vector<Series> &series, size_t threshold);
+
+size_t point_count(const std::vector<Series> &series);
+
+/* {"series":[{"sensor":"76","points":[[time_ms,value],...]},...]}, written as it goes so a large response never
+ * sits in memory twice */
+void encode_json(const std::vector<Series> &series, Sink &sink);
+
+/* A little-endian uint32 series count, then for each a uint8 length and that many bytes of sensor address, a
+ * uint32 point count and that many (float64 seconds, float32 value) pairs, 12 bytes each */
+void encode_binary(const std::vector<Series> &series, Sink &sink);
+
+#endif
@@ -0,0 +1,110 @@
+#include "window_cache.h"
+
+#include <algorithm>
+
+namespace {
+
+// Readings can land a little after their timestamps (the device publishes from a queue), so the end of a
+// cached window is always fetched again
+const double REFRESH_OVERLAP_SECONDS = 300;
+
+bool before(const Point &point, double time) { return point.time < time; }
+
+}  // namespace
+
+WindowCache::WindowCache(ReadingStore &store, size_t max_entries, double window_seconds)
+    : store_(store), max_entries_(max_entries), window_seconds_(window_seconds) {}
+
+std::vector<Series> WindowCache::slice(const std::vector<Series> &series, double from, double to) {
+  std::vector<Series> sliced;
+  for (const Series &one : series) {
+    auto first = std::lower_bound(one.points.begin(), one.points.end(), from, before);
+    auto last = std::lower_bound(first, one.points.end(), to, before);
+    if (first != last) {
+      sliced.push_back(Series{one.sensor_address, std::vector<Point>(first, last)});
+    }
+  }
+  return sliced;
+}
+
+void WindowCache::refresh_tail(Entry &entry, const SeriesKey &key, double to) {
+  double refresh_from = std::max(entry.from, entry.to - REFRESH_OVERLAP_SECONDS);
+  std::vector<Series> fresh = store_.fetch(key, refresh_from, to);
+
+  for (Series &one : entry.series) {
+    auto stale = std::lower_bound(one.points.begin(), one.points.end(), refresh_from, before);
+    one.points.erase(stale, one.points.end());
+  }
+  for (const Series &arrived : fresh) {
+    auto existing = std::find_if(entry.series.begin(), entry.series.end(),
+                                 [&](const Series &one) { return one.sensor_address == arrived.sensor_address; });
+    if (existing == entry.series.end()) {
+      // A sensor that's started reporting since the window was fetched
+      entry.series.push_back(arrived);
+    } else {
+      existing->points.insert(existing->points.end(), arrived.points.begin(), arrived.points.end());
+    }
+  }
+  std::sort(entry.series.begin(), entry.series.end(),
+            [](const Series &a, const Series &b) { return a.sensor_address < b.sensor_address; });
+  entry.to = to;
+
+  // Slide the window forward rather than growing without limit, sensors that have gone quiet go with it
+  double window_start = to - window_seconds_;
+  if (window_start > entry.from) {
+    for (Series &one : entry.series) {
+      auto expired = std::lower_bound(one.points.begin(), one.points.end(), window_start, before);
+      one.points.erase(one.points.begin(), expired);
+    }
+    entry.from = window_start;
+  }
+  entry.series.erase(std::remove_if(entry.series.begin(), entry.series.end(),
+                                    [](const Series &one) { return one.points.empty(); }),
+                     entry.series.end());
+}
+
+void WindowCache::insert(const std::string &key, double from, double to, const std::vector<Series> &series) {
+  if (max_entries_ == 0) {
+    return;
+  }
+  auto existing = index_.find(key);
+  if (existing != index_.end()) {
+    entries_.erase(existing->second);
+    index_.erase(existing);
+  }
+  if (entries_.size() == max_entries_) {
+    index_.erase(entries_.back().key);
+    entries_.pop_back();
+  }
+  entries_.push_front(Entry{key, from, to, series});
+  index_[key] = entries_.begin();
+}
+
+std::vector<Series> WindowCache::get(const SeriesKey &key, double from, double to, bool *hit) {
+  std::string cache_key = key.to_string();
+  auto found = index_.find(cache_key);
+
+  if (found != index_.end()) {
+    Entry &entry = *found->second;
+    // Still inside the window once it's been slid forward to the new end
+    bool covered = from >= entry.from && from >= std::max(entry.from, to - window_seconds_);
+    if (covered && to <= entry.to) {
+      entries_.splice(entries_.begin(), entries_, found->second);
+      *hit = true;
+      return slice(entry.series, from, to);
+    }
+    if (covered) {
+      refresh_tail(entry, key, to);
+      entries_.splice(entries_.begin(), entries_, found->second);
+      *hit = true;
+      return slice(entry.series, from, to);
+    }
+  }
+
+  *hit = false;
+  std::vector<Series> series = store_.fetch(key, from, to);
+  if (to - from <= window_seconds_) {
+    insert(cache_key, from, to, series);
+  }
+  return series;
+}
@@ -0,0 +1,47 @@
+#ifndef window_cache_h
+#define window_cache_h
+
+#include <cstddef>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "reading_store.h"
+#include "series.h"
+
+/**
+ * Keeps the most recent window of raw readings for each series asked for, so a dashboard polling the last
+ * few weeks costs a query for only what's arrived since the last poll. The least recently used series goes
+ * once there are max_entries of them. Not thread safe, like the store.
+ */
+class WindowCache {
+ public:
+  WindowCache(ReadingStore &store, size_t max_entries, double window_seconds);
+
+  // Readings in [from, to) seconds. hit says whether the database was only asked for new readings, if at all.
+  std::vector<Series> get(const SeriesKey &key, double from, double to, bool *hit);
+
+ private:
+  struct Entry {
+    std::string key;
+    // Readings in [from, to) are all here
+    double from;
+    double to;
+    std::vector<Series> series;
+  };
+
+  // Sensors with nothing in [from, to) are left out, as a query for it would leave them out
+  static std::vector<Series> slice(const std::vector<Series> &series, double from, double to);
+  void refresh_tail(Entry &entry, const SeriesKey &key, double to);
+  void insert(const std::string &key, double from, double to, const std::vector<Series> &series);
+
+  ReadingStore &store_;
+  size_t max_entries_;
+  double window_seconds_;
+  // Most recently used first
+  std::list<Entry> entries_;
+  std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+};
+
+#endif
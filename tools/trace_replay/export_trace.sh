@@ -0,0 +1,34 @@
+#!/bin/sh
+# Exports one device's readings and logged decisions as a trace for trace_replay.
+#
+#   ./export_trace.sh <mac> [since] > trace.csv
+#
+# Connection settings come from the usual PG* environment variables, e.g. PGHOST=localhost PGUSER=postgres.
+# since is anything Postgres can compare a timestamp to, e.g. '2020-03-01' (default: everything).
+set -e
+
+if [ $# -lt 1 ]; then
+  echo "Usage: $0 <mac> [since]" >&2
+  exit 2
+fi
+
+# Readings from one sensor in the same second keep the order the device handled them in, decisions come after
+psql --no-psqlrc --quiet --set ON_ERROR_STOP=1 --dbname "${PGDATABASE:-incubator}" \
+  --set mac="$1" --set since="${2:--infinity}" <<'SQL'
+COPY (
+  SELECT client_time, kind, value, sensor_address FROM (
+    SELECT client_time, 'pressure' AS kind, pressure::text AS value, sensor_address, 0 AS step
+      FROM humidity WHERE mac = :'mac' AND client_time >= :'since' AND pressure IS NOT NULL
+    UNION ALL
+    SELECT client_time, 'temperature', temperature::text, sensor_address, 1
+      FROM temperature WHERE mac = :'mac' AND client_time >= :'since'
+    UNION ALL
+    SELECT client_time, 'humidity', humidity::text, sensor_address, 2
+      FROM humidity WHERE mac = :'mac' AND client_time >= :'since'
+    UNION ALL
+    SELECT client_time, actuator, state, NULL, 3
+      FROM actuator_switch WHERE mac = :'mac' AND client_time >= :'since'
+  ) AS trace
+  ORDER BY client_time, sensor_address NULLS LAST, step
+) TO STDOUT WITH CSV HEADER
+SQL
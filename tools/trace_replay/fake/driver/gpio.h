@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+typedef int gpio_num_t;
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level);
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+typedef const char *esp_event_base_t;
+typedef void (*esp_event_handler_t)(void *handler_args, esp_event_base_t base, int32_t id, void *event_data);
+
+#define ESP_EVENT_DECLARE_BASE(id) extern esp_event_base_t const id
+#define ESP_EVENT_DEFINE_BASE(id) esp_event_base_t const id = #id
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "sdkconfig.h"
+
+// Only printed with trace_replay -v, the firmware logs a few lines for every reading
+void fake_log(char level, const char *tag, const char *format, ...);
+
+#define ESP_LOGE(tag, format, ...) fake_log('E', tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) fake_log('W', tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) fake_log('I', tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) fake_log('D', tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) fake_log('V', tag, format, ##__VA_ARGS__)
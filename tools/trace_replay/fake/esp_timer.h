@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+typedef void (*esp_timer_cb_t)(void *arg);
+typedef struct fake_timer *esp_timer_handle_t;
+
+typedef struct {
+  esp_timer_cb_t callback;
+  void *arg;
+  const char *name;
+} esp_timer_create_args_t;
+
+// The replay's virtual clock, microseconds since the start of the trace
+int64_t esp_timer_get_time(void);
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle);
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period);
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+
+// Just enough for the turner and safety supervisor tasks to compile, nothing on the host starts them
+
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+typedef uint8_t StackType_t;
+typedef struct {
+  int unused;
+} StaticTask_t;
+
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t task, const char *name, uint32_t stack_depth, void *parameters,
+                                           UBaseType_t priority, StackType_t *stack, StaticTask_t *task_buffer,
+                                           BaseType_t core);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+TickType_t xTaskGetTickCount(void);
+void vTaskDelayUntil(TickType_t *previous_wake_time, TickType_t time_increment);
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait);
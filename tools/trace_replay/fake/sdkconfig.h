@@ -0,0 +1,34 @@
+/* Kconfig defaults for the settings the replayed and host tested sources read. Build with SDKCONFIG_DIR pointing
+ * at a firmware build's config directory to replay with a device's actual configuration instead. */
+#pragma once
+
+#define CONFIG_ROTATIONS_PER_DAY 5
+#define CONFIG_HUMIDITY_CONTROL_ABSOLUTE 1
+#define CONFIG_FAST_SAMPLING_NEAR_THRESHOLD_DECIDEGREES 1
+#define CONFIG_FAST_SAMPLING_RATE_DECIDEGREES_PER_MINUTE 3
+#define CONFIG_FAST_SAMPLING_HOLD_SECONDS 20
+#define CONFIG_READING_PUBLISH_INTERVAL_SECONDS 10
+#define CONFIG_READ_INTERVAL_SECONDS 20
+#define CONFIG_FAST_READ_INTERVAL_MS 500
+
+#define CONFIG_CONTROL_CORE 1
+#define CONFIG_TURNER_TASK_PRIORITY 4
+
+#define CONFIG_SAFETY_CHECK_PERIOD_MS 500
+#define CONFIG_SAFETY_STALE_READING_SECONDS 60
+#define CONFIG_SAFETY_MAXIMUM_TEMPERATURE_DECIDEGREES 395
+#define CONFIG_SAFETY_MAXIMUM_SENSOR_DISAGREEMENT_DECIDEGREES 15
+#define CONFIG_SAFETY_TASK_PRIORITY 20
+
+#define CONFIG_HEAP_GUARD_WARMUP_CYCLES 3
+
+#define CONFIG_HEATER_GPIO_NUMBER 12
+#define CONFIG_HEATER_ACTIVE_HIGH 1
+#define CONFIG_HEATER_ACTIVE_LEVEL 1
+#define CONFIG_HEATER_MINIMUM_ON_SECONDS 20
+#define CONFIG_HEATER_MINIMUM_OFF_SECONDS 20
+
+#define CONFIG_HUMIDIFIER_GPIO_NUMBER 27
+#define CONFIG_HUMIDIFIER_ACTIVE_LEVEL 0
+#define CONFIG_HUMIDIFIER_MINIMUM_ON_SECONDS 30
+#define CONFIG_HUMIDIFIER_MINIMUM_OFF_SECONDS 30
@@ -0,0 +1,115 @@
+#include "fakes.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "bme280_helper.h"
+#include "driver/gpio.h"
+#include "esp_timer.h"
+#include "freertos/task.h"
+#include "mqtt_helper.h"
+#include "safety_supervisor.h"
+#include "sntp_helper.h"
+#include "task_monitor.h"
+#include "uln2003_stepper_driver.h"
+
+ESP_EVENT_DEFINE_BASE(SENSOR_EVENTS);
+
+static int64_t now_us;
+static bool verbose;
+static uint32_t published_messages;
+// The fast read window being extended, and the ones already over
+static int64_t fast_reads_from_us;
+static int64_t fast_reads_until_us;
+static int64_t fast_reads_closed_us;
+static uint32_t fast_read_windows;
+
+void fake_set_time(int64_t time_us) { now_us = time_us; }
+
+void fake_set_verbose(bool enabled) { verbose = enabled; }
+
+uint32_t fake_published_message_count(void) { return published_messages; }
+
+int64_t fake_fast_read_time_us(int64_t end_us, uint32_t *windows) {
+  *windows = fast_read_windows;
+  int64_t until_us = fast_reads_until_us < end_us ? fast_reads_until_us : end_us;
+  return fast_reads_closed_us + (until_us > fast_reads_from_us ? until_us - fast_reads_from_us : 0);
+}
+
+void fake_log(char level, const char *tag, const char *format, ...) {
+  if (!verbose) {
+    return;
+  }
+  va_list args;
+  va_start(args, format);
+  printf("%c (%lld) %s: ", level, (long long)(now_us / 1000), tag);
+  vprintf(format, args);
+  printf("\n");
+  va_end(args);
+}
+
+int64_t esp_timer_get_time(void) { return now_us; }
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle) {
+  *out_handle = NULL;
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period) { return ESP_OK; }
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level) { return ESP_OK; }
+
+void pinModeOutput(uint8_t pin) {}
+
+// Publishing only counts, decisions are read back from the actuators
+bool publish_message(char datetime[], char topic[], char key[], char payload[]) {
+  published_messages++;
+  return true;
+}
+
+bool publish_fields(char datetime[], char topic[], const char *keys[], const char *values[], int count) {
+  published_messages++;
+  return true;
+}
+
+/* Readings arrive when the trace says, however fast the controller asks for them. The windows it asks for are
+ * kept like the device keeps them, a request before the window ends extends it, so the replay can say how long
+ * a trace would have held the sensors at the fast rate. */
+void request_fast_sensor_reads(uint32_t duration_ms) {
+  int64_t until_us = now_us + duration_ms * 1000LL;
+  if (fast_read_windows == 0 || now_us >= fast_reads_until_us) {
+    fast_reads_closed_us += fast_reads_until_us - fast_reads_from_us;
+    fast_reads_from_us = now_us;
+    fast_reads_until_us = until_us;
+    fast_read_windows++;
+  } else if (until_us > fast_reads_until_us) {
+    fast_reads_until_us = until_us;
+  }
+}
+
+// Only ever published, and publishing goes nowhere
+void get_time_string(char timestring[]) { timestring[0] = '\0'; }
+
+/* The interlocks run on their own task on the device, and a trace of a healthy run never trips them,
+ * so the replay doesn't either */
+void safety_supervisor_record_temperature(int sensor_address, float temperature) {}
+
+bool safety_fault_latched(void) { return false; }
+
+// Latency is a property of the device's scheduling, which the replay doesn't have
+void task_monitor_record_latency(enum LatencySource source, int64_t latency_us) {}
+
+// The turner is never started, the replay doesn't call chicken_start()
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t task, const char *name, uint32_t stack_depth, void *parameters,
+                                           UBaseType_t priority, StackType_t *stack, StaticTask_t *task_buffer,
+                                           BaseType_t core) {
+  return NULL;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) { return pdTRUE; }
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait) { return 0; }
+
+void set_up_uln2003() {}
+
+void rotate() {}
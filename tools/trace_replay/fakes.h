@@ -0,0 +1,15 @@
+#ifndef fakes_h
+#define fakes_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* What the replayed firmware sees of the outside world. Time only moves when the replay says so. */
+
+void fake_set_time(int64_t time_us);
+void fake_set_verbose(bool verbose);
+uint32_t fake_published_message_count(void);
+// Time the controller held the sensors at the fast rate up to end_us, and how many separate windows it asked for
+int64_t fake_fast_read_time_us(int64_t end_us, uint32_t *windows);
+
+#endif
@@ -0,0 +1,431 @@
+/*
+ * Replays recorded readings through the firmware's controller and compares its decisions with the ones the
+ * device logged.
+ *
+ *   trace_replay [-v] [-t tolerance_seconds] [-n max_differences] [-f max_fast_percent] <trace.csv>
+ *
+ * The controller is chicken_incubator.c and actuator.c exactly as the firmware builds them, compiled against
+ * the fakes in this directory. Readings are fed in order on a virtual clock taken from their timestamps, so
+ * dwell times behave as they did on the device and a trace replays as fast as it can be parsed. Exits 1 if
+ * any decision differs, or if the controller keeps the sensors on fast reads for more than max_fast_percent of
+ * the trace (DEFAULT_MAX_FAST_PERCENT), so it doubles as a regression check for controller changes.
+ *
+ * The trace is CSV with a header, as written by export_trace.sh:
+ *
+ *   client_time,kind,value,sensor_address
+ *   2020-03-01 12:00:04,temperature,37.41,76
+ *   2020-03-01 12:00:04,heater,on,
+ *
+ * kind is temperature, humidity or pressure for readings and an actuator name for logged decisions.
+ *
+ * Build with `make` in this directory.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "actuator.h"
+#include "bme280_helper.h"
+#include "chicken_incubator.h"
+#include "fakes.h"
+#include "sdkconfig.h"
+
+// Only a single sensor's address was logged before readings carried one
+#define DEFAULT_SENSOR_ADDRESS 0x76
+#define DEFAULT_TOLERANCE_SECONDS 30
+#define DEFAULT_MAX_DIFFERENCES 20
+// Fast reads are for transients, a controller asking for them much more than this has lost the point of them
+#define DEFAULT_MAX_FAST_PERCENT 20
+#define MAX_FIELDS 4
+
+struct Decision {
+  int64_t time_us;
+  bool on;
+};
+
+struct DecisionList {
+  struct Decision *items;
+  size_t count;
+  size_t capacity;
+};
+
+struct Trace {
+  int64_t start_us;
+  int64_t end_us;
+  size_t readings;
+  size_t skipped_lines;
+};
+
+static struct DecisionList logged[ACTUATOR_COUNT];
+static struct DecisionList replayed[ACTUATOR_COUNT];
+
+static void add_decision(struct DecisionList *list, int64_t time_us, bool on) {
+  if (list->count == list->capacity) {
+    list->capacity = list->capacity ? list->capacity * 2 : 256;
+    list->items = realloc(list->items, list->capacity * sizeof(*list->items));
+  }
+  list->items[list->count++] = (struct Decision){.time_us = time_us, .on = on};
+}
+
+static char *read_file(const char *path, size_t *length) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    perror(path);
+    return NULL;
+  }
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+
+  char *data = malloc(size + 1);
+  if (fread(data, 1, size, file) != (size_t)size) {
+    perror(path);
+    fclose(file);
+    free(data);
+    return NULL;
+  }
+  fclose(file);
+  data[size] = '\0';
+  *length = size;
+  return data;
+}
+
+// Days since 1970-01-01 in the proleptic Gregorian calendar, from Howard Hinnant's days_from_civil
+static int64_t days_from_civil(int64_t year, unsigned month, unsigned day) {
+  year -= month <= 2;
+  int64_t era = (year >= 0 ? year : year - 399) / 400;
+  unsigned year_of_era = (unsigned)(year - era * 400);
+  unsigned day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+  unsigned day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+  return era * 146097 + (int64_t)day_of_era - 719468;
+}
+
+// Reads a fixed number of digits and the separator after them, or returns -1
+static int parse_field(const char **text, int digits, char separator) {
+  int value = 0;
+  for (int i = 0; i < digits; i++) {
+    if (**text < '0' || **text > '9') {
+      return -1;
+    }
+    value = value * 10 + (*(*text)++ - '0');
+  }
+  if (separator != '\0') {
+    // ISO 8601 puts a T between the date and time
+    if (**text != separator && !(separator == ' ' && **text == 'T')) {
+      return -1;
+    }
+    (*text)++;
+  }
+  return value;
+}
+
+/**
+ * Parses Postgres' "YYYY-MM-DD HH:MM:SS[.ffffff]" into microseconds. It's wall clock time on the device, which
+ * is treated as UTC, only differences between readings matter.
+ */
+static bool parse_time(const char *text, int64_t *time_us) {
+  int year = parse_field(&text, 4, '-');
+  int month = parse_field(&text, 2, '-');
+  int day = parse_field(&text, 2, ' ');
+  int hour = parse_field(&text, 2, ':');
+  int minute = parse_field(&text, 2, ':');
+  int second = parse_field(&text, 2, '\0');
+  if (year < 0 || month < 1 || day < 1 || hour < 0 || minute < 0 || second < 0) {
+    return false;
+  }
+
+  int64_t fraction_us = 0;
+  if (*text == '.') {
+    text++;
+    for (int64_t scale = 100000; *text >= '0' && *text <= '9'; scale /= 10) {
+      fraction_us += (*text++ - '0') * scale;
+    }
+  }
+
+  int64_t seconds = days_from_civil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+  *time_us = seconds * 1000000 + fraction_us;
+  return true;
+}
+
+static void format_time(int64_t time_us, char buffer[], size_t size) {
+  time_t seconds = (time_t)(time_us / 1000000);
+  struct tm timeinfo;
+  gmtime_r(&seconds, &timeinfo);
+  strftime(buffer, size, "%Y-%m-%d %H:%M:%S", &timeinfo);
+}
+
+static int actuator_by_name(const char *name) {
+  for (int id = 0; id < ACTUATOR_COUNT; id++) {
+    if (strcmp(actuator_name(id), name) == 0) {
+      return id;
+    }
+  }
+  return -1;
+}
+
+// Splits a line in place. psql only quotes fields that need it, and none of ours do, but quotes are stripped.
+static int split_fields(char *line, char *fields[]) {
+  int count = 0;
+  char *field = line;
+  while (count < MAX_FIELDS) {
+    char *end = strchr(field, ',');
+    if (end != NULL) {
+      *end = '\0';
+    }
+    size_t length = strlen(field);
+    if (length >= 2 && field[0] == '"' && field[length - 1] == '"') {
+      field[length - 1] = '\0';
+      field++;
+    }
+    fields[count++] = field;
+    if (end == NULL) {
+      break;
+    }
+    field = end + 1;
+  }
+  return count;
+}
+
+static void feed_reading(esp_event_handler_t handler, int32_t id, float reading, int sensor_address,
+                         int64_t time_us) {
+  bool was_on[ACTUATOR_COUNT];
+  for (int actuator = 0; actuator < ACTUATOR_COUNT; actuator++) {
+    was_on[actuator] = actuator_is_on(actuator);
+  }
+
+  struct EventData event_data = {.reading = reading, .sensor_address = sensor_address, .read_time_us = time_us};
+  handler(NULL, SENSOR_EVENTS, id, &event_data);
+
+  for (int actuator = 0; actuator < ACTUATOR_COUNT; actuator++) {
+    bool on = actuator_is_on(actuator);
+    if (on != was_on[actuator]) {
+      add_decision(&replayed[actuator], time_us, on);
+    }
+  }
+}
+
+static bool replay_line(char *line, int64_t *clock_us, struct Trace *trace) {
+  char *fields[MAX_FIELDS] = {NULL};
+  int count = split_fields(line, fields);
+  int64_t time_us;
+  if (count < 3 || !parse_time(fields[0], &time_us)) {
+    return false;
+  }
+
+  if (trace->start_us == INT64_MIN) {
+    // The actuators take their first timestamps from the clock, so it has to be at the start of the trace
+    trace->start_us = time_us;
+    fake_set_time(0);
+    initialize_actuators();
+  }
+  // Device time can step backwards on an NTP sync, which the controller never saw as time going backwards
+  if (time_us > *clock_us) {
+    *clock_us = time_us;
+  }
+  trace->end_us = *clock_us;
+  fake_set_time(*clock_us - trace->start_us);
+
+  const char *kind = fields[1];
+  const char *value = fields[2];
+  int sensor_address = count > 3 && fields[3][0] != '\0' ? (int)strtol(fields[3], NULL, 16) : DEFAULT_SENSOR_ADDRESS;
+
+  if (strcmp(kind, "temperature") == 0) {
+    feed_reading(chicken_temperature_reading_handler, SENSOR_READING_TEMPERATURE, strtof(value, NULL),
+                 sensor_address, *clock_us);
+  } else if (strcmp(kind, "humidity") == 0) {
+    feed_reading(chicken_humidity_reading_handler, SENSOR_READING_HUMIDITY, strtof(value, NULL), sensor_address,
+                 *clock_us);
+  } else if (strcmp(kind, "pressure") == 0) {
+    feed_reading(chicken_pressure_reading_handler, SENSOR_READING_PRESSURE, strtof(value, NULL), sensor_address,
+                 *clock_us);
+  } else {
+    int actuator = actuator_by_name(kind);
+    if (actuator < 0 || (strcmp(value, "on") != 0 && strcmp(value, "off") != 0)) {
+      return false;
+    }
+    add_decision(&logged[actuator], *clock_us, strcmp(value, "on") == 0);
+    return true;
+  }
+  trace->readings++;
+  return true;
+}
+
+static int replay(char *data, struct Trace *trace) {
+  int64_t clock_us = INT64_MIN;
+  trace->start_us = INT64_MIN;
+
+  char *line = data;
+  bool first = true;
+  while (line != NULL && *line != '\0') {
+    char *next = strchr(line, '\n');
+    if (next != NULL) {
+      *next++ = '\0';
+    }
+    size_t length = strlen(line);
+    if (length > 0 && line[length - 1] == '\r') {
+      line[length - 1] = '\0';
+    }
+
+    bool header = first && strncmp(line, "client_time", 11) == 0;
+    first = false;
+    if (!header && *line != '\0' && !replay_line(line, &clock_us, trace)) {
+      trace->skipped_lines++;
+    }
+    line = next;
+  }
+  return trace->start_us == INT64_MIN ? -1 : 0;
+}
+
+// Time spent on over the trace, starting off as the device does after a reset
+static int64_t on_time_us(const struct DecisionList *list, const struct Trace *trace) {
+  int64_t total = 0;
+  int64_t on_since = -1;
+  for (size_t i = 0; i < list->count; i++) {
+    if (list->items[i].on && on_since < 0) {
+      on_since = list->items[i].time_us;
+    } else if (!list->items[i].on && on_since >= 0) {
+      total += list->items[i].time_us - on_since;
+      on_since = -1;
+    }
+  }
+  if (on_since >= 0) {
+    total += trace->end_us - on_since;
+  }
+  return total;
+}
+
+static void print_difference(const char *name, const char *source, const struct Decision *decision) {
+  char time_text[32];
+  format_time(decision->time_us, time_text, sizeof(time_text));
+  printf("  %s %s %s only in the %s\n", time_text, name, decision->on ? "on " : "off", source);
+}
+
+/**
+ * Pairs up logged and replayed decisions in time order. A pair matches if it's the same switch within the
+ * tolerance, anything else is a difference. Returns the number of differences.
+ */
+static size_t compare(int actuator, int64_t tolerance_us, size_t max_differences, size_t *printed) {
+  const struct DecisionList *expected = &logged[actuator];
+  const struct DecisionList *actual = &replayed[actuator];
+  const char *name = actuator_name(actuator);
+  size_t i = 0;
+  size_t j = 0;
+  size_t differences = 0;
+
+  while (i < expected->count || j < actual->count) {
+    const struct Decision *log = i < expected->count ? &expected->items[i] : NULL;
+    const struct Decision *replay = j < actual->count ? &actual->items[j] : NULL;
+
+    if (log != NULL && replay != NULL && log->on == replay->on && llabs(log->time_us - replay->time_us) <= tolerance_us) {
+      i++;
+      j++;
+      continue;
+    }
+
+    differences++;
+    bool log_first = replay == NULL || (log != NULL && log->time_us <= replay->time_us);
+    if (*printed < max_differences) {
+      print_difference(name, log_first ? "log" : "replay", log_first ? log : replay);
+      (*printed)++;
+    }
+    if (log_first) {
+      i++;
+    } else {
+      j++;
+    }
+  }
+  return differences;
+}
+
+static double elapsed_ms(const struct timespec *start, const struct timespec *end) {
+  return (end->tv_sec - start->tv_sec) * 1000.0 + (end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+int main(int argc, char *argv[]) {
+  int64_t tolerance_us = DEFAULT_TOLERANCE_SECONDS * 1000000LL;
+  size_t max_differences = DEFAULT_MAX_DIFFERENCES;
+  double max_fast_percent = DEFAULT_MAX_FAST_PERCENT;
+  int option;
+  while ((option = getopt(argc, argv, "vt:n:f:")) != -1) {
+    switch (option) {
+      case 'v':
+        fake_set_verbose(true);
+        break;
+      case 't':
+        tolerance_us = (int64_t)(atof(optarg) * 1e6);
+        break;
+      case 'n':
+        max_differences = (size_t)atol(optarg);
+        break;
+      case 'f':
+        max_fast_percent = atof(optarg);
+        break;
+      default:
+        optind = argc;
+        break;
+    }
+  }
+  if (optind != argc - 1) {
+    fprintf(stderr, "Usage: %s [-v] [-t tolerance_seconds] [-n max_differences] [-f max_fast_percent] <trace.csv>\n", argv[0]);
+    return 2;
+  }
+
+  size_t length;
+  char *data = read_file(argv[optind], &length);
+  if (data == NULL) {
+    return 2;
+  }
+
+  struct timespec started, finished;
+  struct Trace trace = {0};
+  clock_gettime(CLOCK_MONOTONIC, &started);
+  int result = replay(data, &trace);
+  clock_gettime(CLOCK_MONOTONIC, &finished);
+  free(data);
+  if (result != 0) {
+    fprintf(stderr, "%s: no readings\n", argv[optind]);
+    return 2;
+  }
+
+  double days = (trace.end_us - trace.start_us) / 86400e6;
+  printf("Replayed %zu readings over %.2f days in %.1f ms", trace.readings, days, elapsed_ms(&started, &finished));
+  if (trace.skipped_lines > 0) {
+    printf(", skipped %zu lines that weren't readings or decisions", trace.skipped_lines);
+  }
+  printf("\n");
+
+  uint32_t fast_windows;
+  int64_t fast_us = fake_fast_read_time_us(trace.end_us, &fast_windows);
+  double span_seconds = (trace.end_us - trace.start_us) / 1e6;
+  double fast_seconds = fast_us / 1e6;
+  // What the sensors would have been read at on the device, against reading at the steady state rate throughout
+  double reads_per_day = span_seconds > 0 ? (fast_seconds / (CONFIG_FAST_READ_INTERVAL_MS / 1000.0) +
+                                             (span_seconds - fast_seconds) / CONFIG_READ_INTERVAL_SECONDS) *
+                                                86400 / span_seconds
+                                          : 0;
+  double fast_percent = span_seconds > 0 ? 100.0 * fast_seconds / span_seconds : 0;
+  printf("Fast reads: %u windows, %.1f%% of the time%s. About %.0f reads a day per sensor, %.0f at %d s throughout\n",
+         fast_windows, fast_percent, fast_percent > max_fast_percent ? " (over budget)" : "", reads_per_day,
+         86400.0 / CONFIG_READ_INTERVAL_SECONDS, CONFIG_READ_INTERVAL_SECONDS);
+
+  size_t total_differences = 0;
+  size_t printed = 0;
+  double span_us = trace.end_us > trace.start_us ? (double)(trace.end_us - trace.start_us) : 1;
+  for (int actuator = 0; actuator < ACTUATOR_COUNT; actuator++) {
+    size_t differences = compare(actuator, tolerance_us, max_differences, &printed);
+    total_differences += differences;
+    printf("%s: %zu switches logged, %zu replayed, %zu differ. On %.1f%% of the time logged, %.1f%% replayed\n",
+           actuator_name(actuator), logged[actuator].count, replayed[actuator].count, differences,
+           100.0 * on_time_us(&logged[actuator], &trace) / span_us,
+           100.0 * on_time_us(&replayed[actuator], &trace) / span_us);
+  }
+  if (printed < total_differences) {
+    printf("(%zu more differences not shown)\n", total_differences - printed);
+  }
+
+  return total_differences == 0 && fast_percent <= max_fast_percent ? 0 : 1;
+}